@@ -8,6 +8,14 @@ CoreConfig::CoreConfig(const ConfigNode& node)
 	}
 	blockedExtensions = node["blockedExtensions"].asVector<String>({});
 	multithreadedLoading = node["multithreadedLoading"].asBool(true);
+	threadedEmulation = node["threadedEmulation"].asBool(false);
+	lateInputLatch = node["lateInputLatch"].asBool(false);
+	if (node.hasKey("runAhead")) {
+		runAheadFrames = clamp(node["runAhead"].asInt(), 0, 4);
+	}
+	if (node.hasKey("runAheadMode")) {
+		runAheadMode = node["runAheadMode"].asEnum<RunAheadMode>();
+	}
 }
 
 const String& CoreConfig::getId() const
@@ -37,3 +45,23 @@ bool CoreConfig::hasMultithreadedLoading() const
 {
 	return multithreadedLoading;
 }
+
+bool CoreConfig::hasThreadedEmulation() const
+{
+	return threadedEmulation;
+}
+
+bool CoreConfig::hasLateInputLatch() const
+{
+	return lateInputLatch;
+}
+
+std::optional<int> CoreConfig::getRunAheadFrames() const
+{
+	return runAheadFrames;
+}
+
+RunAheadMode CoreConfig::getRunAheadMode() const
+{
+	return runAheadMode;
+}
@@ -3,6 +3,23 @@
 #include <halley.hpp>
 using namespace Halley;
 
+enum class RunAheadMode {
+    SameInstance,
+    SecondInstance
+};
+
+namespace Halley {
+	template <>
+	struct EnumNames<RunAheadMode> {
+		constexpr std::array<const char*, 2> operator()() const {
+			return{{
+				"sameInstance",
+				"secondInstance"
+			}};
+		}
+	};
+}
+
 class CoreConfig {
 public:
     CoreConfig() = default;
@@ -13,10 +30,18 @@ public:
     Vector<String> filterExtensions(Vector<String> reportedByCore) const;
     const Vector<String>& getBlockedExtensions() const;
     bool hasMultithreadedLoading() const;
+    bool hasThreadedEmulation() const;
+    bool hasLateInputLatch() const;
+    std::optional<int> getRunAheadFrames() const;
+    RunAheadMode getRunAheadMode() const;
 
 private:
     String id;
     HashMap<String, String> options;
     Vector<String> blockedExtensions;
     bool multithreadedLoading = true;
+    bool threadedEmulation = false;
+    bool lateInputLatch = false;
+    std::optional<int> runAheadFrames;
+    RunAheadMode runAheadMode = RunAheadMode::SameInstance;
 };
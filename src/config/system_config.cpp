@@ -117,6 +117,7 @@ SystemConfig::SystemConfig(const ConfigNode& node)
 	bezels = node["bezels"].asVector<String>({});
 	mapping = node["mapping"].asString("");
 	capabilities = node["capabilities"].asHashMap<SystemCapability, bool>();
+	runAheadFrames = clamp(node["runAhead"].asInt(0), 0, 4);
 }
 
 const String& SystemConfig::getId() const
@@ -192,6 +193,11 @@ const String& SystemConfig::getMapping() const
 	return mapping;
 }
 
+int SystemConfig::getRunAheadFrames() const
+{
+	return runAheadFrames;
+}
+
 String SystemConfig::getDescriptionKey() const
 {
 	return "system_description_" + id;
@@ -93,6 +93,7 @@ public:
     int getUnitsSold() const;
     SystemCategory getCategory() const;
     const String& getMapping() const;
+    int getRunAheadFrames() const;
 
 	String getDescriptionKey() const;
 
@@ -111,4 +112,5 @@ private:
     int unitsSold;
     HashMap<SystemCapability, bool> capabilities;
     String mapping;
+    int runAheadFrames = 0;
 };
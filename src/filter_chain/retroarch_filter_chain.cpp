@@ -3,6 +3,7 @@
 #include "material_generator.h"
 #include "retroarch_shader_parser.h"
 #include "shader_converter.h"
+#include "src/util/frame_trace.h"
 
 // Details: https://github.com/libretro/slang-shaders
 
@@ -42,6 +43,7 @@ void RetroarchFilterChain::Stage::loadMaterial(ShaderConverter& converter, Video
 	}
 	shaderRenderFormat = parsed.format;
 	shaderName = parsed.name;
+	traceName = FrameTrace::intern("filter_stage_" + toString(index) + "_" + shaderName);
 
 	const auto outputFormat = fromString<ShaderFormat>(video.getShaderLanguage());
 	const auto vertexShader = converter.convertShader(parsed.vertexShader, ShaderStage::Vertex, ShaderFormat::GLSL, outputFormat);
@@ -291,6 +293,7 @@ Sprite RetroarchFilterChain::run(const Sprite& src, RenderContext& rc, Vector2i
 
 	// Draw stages
 	for (auto& stage: stages) {
+		TraceScope trace(stage.traceName);
 		updateStageMaterial(stage, frameParams);
 
 		rc.with(stage.renderSurface->getRenderTarget()).bind([&] (Painter& painter)
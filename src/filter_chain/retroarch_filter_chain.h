@@ -70,6 +70,7 @@ public:
 
 		String shaderName;
 		String shaderRenderFormat;
+		const char* traceName = nullptr;
 
 		std::shared_ptr<Material> material;
 		std::shared_ptr<MaterialDefinition> materialDefinition;
@@ -0,0 +1,134 @@
+#include "emulation_thread.h"
+
+#include "src/util/frame_trace.h"
+
+EmulationThread::EmulationThread(LibretroCore& core, const HalleyAPI& api, StepFunction step)
+	: core(core)
+	, step(std::move(step))
+	, inputQueue(8)
+{
+	core.setExternalInput(true);
+	thread = api.system->createThread("emulation", ThreadPriority::High, [=] () { run(); });
+}
+
+EmulationThread::~EmulationThread()
+{
+	running = false;
+	if (thread.joinable()) {
+		thread.join();
+	}
+
+	core.setVideoCapture(nullptr);
+	core.setExternalInput(false);
+}
+
+void EmulationThread::setPaused(bool p)
+{
+	if (paused != p) {
+		if (p) {
+			paused = true;
+		}
+
+		// Wait for any frame in flight, so the core is idle while its pause state changes
+		{
+			std::unique_lock<std::mutex> l(coreMutex);
+			core.setPaused(p);
+		}
+
+		if (!p) {
+			paused = false;
+		}
+	}
+}
+
+void EmulationThread::setFastForwarding(bool ffwd)
+{
+	fastForwarding = ffwd;
+}
+
+void EmulationThread::pushInput(const LibretroCore::InputSnapshot& snapshot)
+{
+	// If the queue is full the emulation thread is behind, and will catch up with the snapshots already queued
+	inputQueue.tryPush(snapshot);
+}
+
+bool EmulationThread::presentLatestFrame()
+{
+	if (frames.consume()) {
+		core.presentVideoFrame(frames.getReadBuffer());
+		return true;
+	}
+	return false;
+}
+
+std::unique_lock<std::mutex> EmulationThread::lock()
+{
+	return std::unique_lock<std::mutex>(coreMutex);
+}
+
+void EmulationThread::run()
+{
+	FrameTrace::setThreadName("emulation");
+	auto nextFrame = Clock::now();
+
+	while (running) {
+		if (paused) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			nextFrame = Clock::now();
+			continue;
+		}
+
+		if (!fastForwarding) {
+			waitUntil(nextFrame);
+		}
+
+		runFrame();
+
+		const auto frameLength = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / core.getSystemAVInfo().fps));
+		nextFrame += frameLength;
+
+		// Don't try to catch up if we fell behind by more than a few frames (e.g. after a stall), just resync
+		const auto now = Clock::now();
+		if (now - nextFrame > frameLength * 3 || fastForwarding) {
+			nextFrame = now;
+		}
+	}
+}
+
+void EmulationThread::runFrame()
+{
+	std::unique_lock<std::mutex> l(coreMutex);
+	if (paused) {
+		return;
+	}
+
+	// Only the most recent input matters
+	while (inputQueue.tryPop(curInput)) {}
+	core.setInputSnapshot(curInput);
+
+	auto& frame = frames.getWriteBuffer();
+	frame.dupe = true;
+	core.setVideoCapture(&frame);
+
+	step();
+	core.finishRunAhead();
+
+	core.setVideoCapture(nullptr);
+
+	// Publishing a dupe could replace a real frame that hasn't been presented yet
+	if (!frame.dupe) {
+		frames.publish();
+	}
+}
+
+void EmulationThread::waitUntil(Clock::time_point time) const
+{
+	// The OS sleep granularity is too coarse for frame pacing, so sleep most of the way and spin for the rest
+	constexpr auto spinTime = std::chrono::milliseconds(2);
+	if (time - Clock::now() > spinTime) {
+		std::this_thread::sleep_until(time - spinTime);
+	}
+	while (Clock::now() < time && running) {
+		std::this_thread::yield();
+	}
+}
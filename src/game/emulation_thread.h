@@ -0,0 +1,49 @@
+#pragma once
+
+#include <halley.hpp>
+
+#include "src/libretro/libretro_core.h"
+#include "src/util/spsc_queue.h"
+#include "src/util/triple_buffer.h"
+using namespace Halley;
+
+// Runs the core on its own thread, paced to the core's frame rate
+// Input flows in through a lock-free queue, and frames flow out through a triple buffer, so neither side waits on the other
+class EmulationThread {
+public:
+    using StepFunction = std::function<void()>;
+
+    EmulationThread(LibretroCore& core, const HalleyAPI& api, StepFunction step);
+    ~EmulationThread();
+
+    EmulationThread(const EmulationThread& other) = delete;
+    EmulationThread& operator=(const EmulationThread& other) = delete;
+
+    void setPaused(bool paused); // Also pauses the core, in between frames
+    void setFastForwarding(bool ffwd);
+    void pushInput(const LibretroCore::InputSnapshot& snapshot);
+    bool presentLatestFrame();
+
+    // Holding this lock prevents the emulation thread from running a frame
+    [[nodiscard]] std::unique_lock<std::mutex> lock();
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    LibretroCore& core;
+    StepFunction step;
+
+    SPSCQueue<LibretroCore::InputSnapshot> inputQueue;
+    LibretroCore::InputSnapshot curInput;
+    TripleBuffer<LibretroCore::VideoFrame> frames;
+
+    std::mutex coreMutex;
+    std::atomic<bool> running = true;
+    std::atomic<bool> paused = false;
+    std::atomic<bool> fastForwarding = false;
+    std::thread thread;
+
+    void run();
+    void runFrame();
+    void waitUntil(Clock::time_point time) const;
+};
@@ -0,0 +1,93 @@
+#include "fast_forward_governor.h"
+
+double FastForwardGovernor::Stats::getSpeed() const
+{
+	return wallTime > 0 && coreFps > 0 ? static_cast<double>(framesRun) / wallTime / coreFps : 0.0;
+}
+
+String FastForwardGovernor::Stats::toString() const
+{
+	const auto avgFrame = framesRun > 0 ? coreTime / framesRun : 0.0;
+	return Halley::toString(getSpeed(), 1) + "x (" + Halley::toString(framesRun) + " frames over " + Halley::toString(displayFrames) + " display frames, "
+		+ Halley::toString(avgFrame * 1000.0, 2) + " ms/frame, " + Halley::toString(budgetCutoffs) + " budget cutoffs)";
+}
+
+void FastForwardGovernor::setSpeed(float multiplier)
+{
+	speed = std::max(multiplier, 0.0f);
+}
+
+float FastForwardGovernor::getSpeed() const
+{
+	return speed;
+}
+
+void FastForwardGovernor::reset()
+{
+	lastTimestamp = {};
+	accumulator = 0;
+	targetFrames = 0;
+	framesRun = 0;
+	elapsed = 0;
+}
+
+int FastForwardGovernor::beginDisplayFrame(Time timestamp, double coreFps)
+{
+	// The real interval drives the speed cap, the smoothed one only sets the time budget
+	Time dt = displayFrameTime;
+	if (lastTimestamp) {
+		dt = std::min(timestamp - *lastTimestamp, maxDisplayFrameTime);
+		displayFrameTime = lerp(displayFrameTime, clamp(dt, minDisplayFrameTime, maxDisplayFrameTime), 0.1);
+		stats.wallTime += timestamp - *lastTimestamp;
+	}
+	lastTimestamp = timestamp;
+
+	if (speed >= 1.0f) {
+		accumulator += speed * coreFps * dt;
+		targetFrames = std::min(static_cast<int>(accumulator), maxFramesPerDisplayFrame);
+		accumulator = std::min(accumulator - targetFrames, 1.0); // Don't build up debt when the budget cuts us short
+	} else {
+		targetFrames = maxFramesPerDisplayFrame;
+	}
+
+	framesRun = 0;
+	elapsed = 0;
+	stats.displayFrames++;
+	stats.coreFps = coreFps;
+
+	return targetFrames;
+}
+
+bool FastForwardGovernor::isLastFrame() const
+{
+	if (framesRun + 1 >= targetFrames) {
+		return true;
+	}
+
+	// Stop if one more frame after this would likely push us past the budget
+	return elapsed + 2 * averageFrameTime > displayFrameTime * budgetFraction;
+}
+
+void FastForwardGovernor::onFrameRun(Time frameTime)
+{
+	if (isLastFrame() && framesRun + 1 < targetFrames) {
+		stats.budgetCutoffs++;
+	}
+
+	framesRun++;
+	elapsed += frameTime;
+	averageFrameTime = averageFrameTime > 0 ? lerp(averageFrameTime, frameTime, 0.1) : frameTime;
+
+	stats.framesRun++;
+	stats.coreTime += frameTime;
+}
+
+const FastForwardGovernor::Stats& FastForwardGovernor::getStats() const
+{
+	return stats;
+}
+
+void FastForwardGovernor::resetStats()
+{
+	stats = {};
+}
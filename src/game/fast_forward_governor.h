@@ -0,0 +1,53 @@
+#pragma once
+
+#include <halley.hpp>
+using namespace Halley;
+
+// Decides how many core frames to run per display frame while fast-forwarding
+// The frame count follows the speed multiplier (or is unbounded when uncapped), but is always cut short once the
+// frames run in this display frame are about to exceed a share of the display frame time, so rendering keeps up.
+class FastForwardGovernor {
+public:
+	struct Stats {
+		int displayFrames = 0;
+		int framesRun = 0;
+		int budgetCutoffs = 0;
+		Time coreTime = 0;
+		Time wallTime = 0;
+		double coreFps = 0;
+
+		double getSpeed() const;
+		String toString() const;
+	};
+
+	void setSpeed(float multiplier); // Below 1 means uncapped, as in libretro
+	float getSpeed() const;
+	void reset();
+
+	// Returns the number of frames the speed target allows this display frame, which may be 0 when capped
+	int beginDisplayFrame(Time timestamp, double coreFps);
+	bool isLastFrame() const;
+	void onFrameRun(Time frameTime);
+
+	const Stats& getStats() const;
+	void resetStats();
+
+private:
+	constexpr static int maxFramesPerDisplayFrame = 64;
+	constexpr static Time minDisplayFrameTime = 1.0 / 240.0;
+	constexpr static Time maxDisplayFrameTime = 1.0 / 30.0;
+	constexpr static Time budgetFraction = 0.75;
+
+	float speed = 0;
+	double accumulator = 0;
+
+	std::optional<Time> lastTimestamp;
+	Time displayFrameTime = 1.0 / 60.0;
+	Time averageFrameTime = 0;
+
+	int targetFrames = 0;
+	int framesRun = 0;
+	Time elapsed = 0;
+
+	Stats stats;
+};
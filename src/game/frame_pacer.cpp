@@ -0,0 +1,211 @@
+#include "frame_pacer.h"
+
+String FramePacer::Stats::toString() const
+{
+	return Halley::toString(refreshRate, 2) + " Hz, " + Halley::toString(framesRun) + " frames in " + Halley::toString(refreshes) + " refreshes, cadence "
+		+ Halley::toString(cadenceFrames) + ":" + Halley::toString(cadenceRefreshes) + ", jitter " + Halley::toString(jitter * 1000.0, 3) + " ms (max "
+		+ Halley::toString(maxError * 1000.0, 3) + " ms), " + Halley::toString(missedVsyncs) + " missed vsyncs, " + Halley::toString(cadenceBreaks)
+		+ " cadence breaks, " + Halley::toString(driftCorrections) + " drift corrections";
+}
+
+void FramePacer::setCoreFPS(double fps)
+{
+	if (fps > 0 && std::abs(fps - coreFps) > 0.0001) {
+		coreFps = fps;
+		updateCadence();
+	}
+}
+
+void FramePacer::reset()
+{
+	lastVsync = {};
+	lastPresent = {};
+	refreshesSinceLastPresent = 0;
+	accumulator = 0;
+	drift = 0;
+}
+
+int FramePacer::onVsync(Time timestamp)
+{
+	int refreshes = 1;
+	if (lastVsync) {
+		const Time interval = timestamp - *lastVsync;
+		if (interval <= 0) {
+			return 0;
+		}
+
+		// More than one refresh elapsed since the last call, so we missed vsync(s)
+		if (refreshSamples >= warmUpSamples) {
+			refreshes = std::max(1, static_cast<int>(std::lround(interval / refreshPeriod)));
+		}
+		if (refreshes > 1) {
+			stats.missedVsyncs += refreshes - 1;
+		} else {
+			updateRefreshEstimate(interval);
+		}
+	}
+	lastVsync = timestamp;
+
+	// Keep emulation time tracking wall time after a missed vsync, but don't try to catch up on long stalls
+	int frames = 0;
+	for (int i = 0; i < std::min(refreshes, 4); ++i) {
+		frames += advance();
+	}
+
+	stats.refreshes += refreshes;
+	refreshesSinceLastPresent += refreshes;
+	if (frames > 0) {
+		recordPresent(timestamp, refreshesSinceLastPresent);
+		refreshesSinceLastPresent = 0;
+		stats.framesRun += frames;
+	}
+
+	return frames;
+}
+
+double FramePacer::getRefreshRate() const
+{
+	return 1.0 / refreshPeriod;
+}
+
+String FramePacer::getCadenceString() const
+{
+	// Simulate one full cycle of the pattern from a clean state
+	// If the core is slower than the display, this lists how many refreshes each frame is held for, otherwise how many frames run on each refresh
+	Vector<String> pattern;
+	int acc = 0;
+	int hold = 0;
+	for (int i = 0; i < cadenceRefreshes; ++i) {
+		acc += cadenceFrames;
+		++hold;
+		const int frames = acc / cadenceRefreshes;
+		acc %= cadenceRefreshes;
+		if (cadenceFrames > cadenceRefreshes) {
+			pattern.push_back(toString(frames));
+		} else if (frames > 0) {
+			pattern.push_back(toString(hold));
+			hold = 0;
+		}
+	}
+	return String::concat<String>(pattern.span(), "-");
+}
+
+const FramePacer::Stats& FramePacer::getStats() const
+{
+	return stats;
+}
+
+void FramePacer::resetStats()
+{
+	stats = {};
+	stats.refreshRate = getRefreshRate();
+	stats.coreFps = coreFps;
+	stats.cadenceFrames = cadenceFrames;
+	stats.cadenceRefreshes = cadenceRefreshes;
+	jitterSquaredSum = 0;
+	jitterSamples = 0;
+}
+
+void FramePacer::updateRefreshEstimate(Time interval)
+{
+	if (refreshSamples < warmUpSamples) {
+		// Plain average until we have a reasonable estimate
+		if (interval > 0.1) {
+			return;
+		}
+		++refreshSamples;
+		refreshPeriod = refreshSamples == 1 ? interval : lerp(refreshPeriod, interval, 1.0 / refreshSamples);
+	} else {
+		// Ignore outliers, as those are most likely stalls rather than the display changing rate
+		if (interval < refreshPeriod * 0.75 || interval > refreshPeriod * 1.25) {
+			return;
+		}
+		refreshPeriod = lerp(refreshPeriod, interval, 0.02);
+	}
+
+	// The cadence picked from an early, noisy estimate may no longer be close enough even if the rate barely moved since
+	const double ratio = coreFps * refreshPeriod;
+	const double cadenceError = std::abs(ratio - static_cast<double>(cadenceFrames) / cadenceRefreshes);
+	if (std::abs(getRefreshRate() - cadenceRefreshRate) > cadenceRefreshRate * refreshTolerance || cadenceError > ratio * cadenceTolerance) {
+		updateCadence();
+	}
+}
+
+void FramePacer::updateCadence()
+{
+	const double ratio = coreFps * refreshPeriod;
+
+	// Pick the smallest denominator that's close enough, so the pattern stays short and stable
+	int bestFrames = std::max(1, static_cast<int>(std::lround(ratio)));
+	int bestRefreshes = 1;
+	double bestError = std::abs(ratio - bestFrames);
+	for (int q = 1; q <= maxCadenceRefreshes; ++q) {
+		const int p = std::max(1, static_cast<int>(std::lround(ratio * q)));
+		const double error = std::abs(ratio - static_cast<double>(p) / q);
+		if (error < bestError - 0.000001) {
+			bestFrames = p;
+			bestRefreshes = q;
+			bestError = error;
+		}
+		if (error < ratio * cadenceTolerance) {
+			break;
+		}
+	}
+
+	if (bestFrames != cadenceFrames || bestRefreshes != cadenceRefreshes) {
+		accumulator = accumulator * bestRefreshes / cadenceRefreshes;
+		cadenceFrames = bestFrames;
+		cadenceRefreshes = bestRefreshes;
+		drift = 0;
+	}
+	cadenceRefreshRate = getRefreshRate();
+	stats.refreshRate = cadenceRefreshRate;
+	stats.coreFps = coreFps;
+	stats.cadenceFrames = cadenceFrames;
+	stats.cadenceRefreshes = cadenceRefreshes;
+}
+
+int FramePacer::advance()
+{
+	// The cadence is only an approximation of the real ratio, so nudge the accumulator by one step whenever the
+	// difference adds up to a step's worth. This shifts the pattern by a single refresh at most, instead of dropping or doubling a frame.
+	drift += coreFps * refreshPeriod - static_cast<double>(cadenceFrames) / cadenceRefreshes;
+	const double step = 1.0 / cadenceRefreshes;
+	int correction = 0;
+	if (drift >= step) {
+		correction = 1;
+	} else if (drift <= -step) {
+		correction = -1;
+	}
+	if (correction != 0) {
+		drift -= correction * step;
+		++stats.driftCorrections;
+	}
+
+	accumulator += cadenceFrames + correction;
+	int frames = 0;
+	while (accumulator >= cadenceRefreshes) {
+		accumulator -= cadenceRefreshes;
+		++frames;
+	}
+	return frames;
+}
+
+void FramePacer::recordPresent(Time timestamp, int refreshes)
+{
+	if (lastPresent) {
+		const Time interval = timestamp - *lastPresent;
+		const Time error = std::abs(interval - refreshes * refreshPeriod);
+		jitterSquaredSum += error * error;
+		++jitterSamples;
+		stats.jitter = std::sqrt(jitterSquaredSum / jitterSamples);
+		stats.maxError = std::max(stats.maxError, error);
+
+		// When the core is slower than the display, every frame should be held for the same number of refreshes, give or take one
+		const double holdRefreshes = static_cast<double>(cadenceRefreshes) / cadenceFrames;
+		if (cadenceFrames <= cadenceRefreshes && (refreshes < std::floor(holdRefreshes) || refreshes > std::ceil(holdRefreshes))) {
+			++stats.cadenceBreaks;
+		}
+	}
+	lastPresent = timestamp;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <halley.hpp>
+using namespace Halley;
+
+// Decides how many core frames to run on each display refresh
+// The cadence is a deterministic pattern (e.g. 3-2-3-2-2 for a 60 Hz core on a 144 Hz display), derived from a rational
+// approximation of the core/display rate ratio, with the residual drift corrected in small steps.
+// It's driven purely by the timestamps passed in, so it can be fed from a simulated vsync clock.
+class FramePacer {
+public:
+	struct Stats {
+		double refreshRate = 0;
+		double coreFps = 0;
+		int cadenceFrames = 0; // Core frames...
+		int cadenceRefreshes = 0; // ...per this many display refreshes
+		int refreshes = 0;
+		int framesRun = 0;
+		int missedVsyncs = 0;
+		int cadenceBreaks = 0;
+		int driftCorrections = 0;
+		Time jitter = 0; // RMS deviation between frame present intervals and the refresh grid
+		Time maxError = 0;
+
+		String toString() const;
+	};
+
+	void setCoreFPS(double fps);
+	void reset();
+
+	int onVsync(Time timestamp);
+
+	double getRefreshRate() const;
+	String getCadenceString() const;
+	const Stats& getStats() const;
+	void resetStats();
+
+private:
+	constexpr static int maxCadenceRefreshes = 64;
+	constexpr static int warmUpSamples = 16;
+	constexpr static double refreshTolerance = 0.005;
+	constexpr static double cadenceTolerance = 0.002; // Relative error of the cadence against the real rate ratio that's close enough
+
+	double coreFps = 60.0;
+	Time refreshPeriod = 1.0 / 60.0;
+	int refreshSamples = 0;
+
+	std::optional<Time> lastVsync;
+	std::optional<Time> lastPresent;
+	int refreshesSinceLastPresent = 0;
+
+	// Bresenham state: cadenceFrames is added every refresh, and a frame runs for every cadenceRefreshes accumulated
+	int cadenceFrames = 1;
+	int cadenceRefreshes = 1;
+	int accumulator = 0;
+	double cadenceRefreshRate = 0;
+	double drift = 0;
+
+	Stats stats;
+	double jitterSquaredSum = 0;
+	int jitterSamples = 0;
+
+	void updateRefreshEstimate(Time interval);
+	void updateCadence();
+	int advance();
+	void recordPresent(Time timestamp, int refreshes);
+};
@@ -0,0 +1,102 @@
+#include "frame_pacer_simulation.h"
+
+#include <random>
+
+#include "frame_pacer.h"
+
+namespace {
+	struct SimulationScenario {
+		const char* name;
+		double refreshRate;
+		double coreFps;
+		Time jitter; // Each timestamp is displaced by up to this much either way
+		double drift; // Relative change of the refresh period per second
+		int dropEvery; // Skip every nth vsync, 0 for never
+		int cadenceFrames; // Expected cadence
+		int cadenceRefreshes;
+	};
+}
+
+bool FramePacerSimulation::run()
+{
+	const std::array<SimulationScenario, 9> scenarios = {{
+		{ "144 Hz, 60 fps", 144.0, 60.0, 0, 0, 0, 5, 12 },
+		{ "120 Hz, 60 fps", 120.0, 60.0, 0, 0, 0, 1, 2 },
+		{ "60 Hz, 60 fps", 60.0, 60.0, 0, 0, 0, 1, 1 },
+		{ "144 Hz, 60 fps, jitter", 144.0, 60.0, 0.0005, 0, 0, 5, 12 },
+		{ "120 Hz, 60 fps, jitter", 120.0, 60.0, 0.0005, 0, 0, 1, 2 },
+		{ "60 Hz, 60 fps, jitter", 60.0, 60.0, 0.001, 0, 0, 1, 1 },
+		{ "143.9 Hz, 60 fps, jitter and drift", 143.9, 60.0, 0.0003, -0.00002, 0, 5, 12 },
+		{ "59.94 Hz, 60.0988 fps, jitter and drift", 59.94, 60.0988, 0.0003, 0.00002, 0, 1, 1 },
+		{ "144 Hz, 60 fps, missed vsyncs", 144.0, 60.0, 0, 0, 97, 5, 12 }
+	}};
+	constexpr Time warmUpTime = 2.0;
+	constexpr Time runTime = 60.0;
+
+	bool allPassed = true;
+	for (const auto& scenario: scenarios) {
+		FramePacer pacer;
+		pacer.setCoreFPS(scenario.coreFps);
+		std::mt19937 rng(1234);
+		std::uniform_real_distribution<double> jitter(-scenario.jitter, scenario.jitter);
+
+		Time vsync = 0;
+		Time period = 1.0 / scenario.refreshRate;
+		Time runStart = 0;
+		bool warmedUp = false;
+		int frames = 0;
+		int dropped = 0;
+		for (int refresh = 1; vsync < warmUpTime + runTime; ++refresh) {
+			vsync += period;
+			period *= 1.0 + scenario.drift * period;
+
+			if (scenario.dropEvery > 0 && refresh % scenario.dropEvery == 0) {
+				dropped += warmedUp ? 1 : 0;
+				continue;
+			}
+			const int n = pacer.onVsync(vsync + (scenario.jitter > 0 ? jitter(rng) : 0.0));
+			if (!warmedUp && vsync >= warmUpTime) {
+				warmedUp = true;
+				runStart = vsync;
+				pacer.resetStats();
+			} else if (warmedUp) {
+				frames += n;
+			}
+		}
+
+		const auto& stats = pacer.getStats();
+		Vector<String> failures;
+		if (stats.cadenceFrames != scenario.cadenceFrames || stats.cadenceRefreshes != scenario.cadenceRefreshes) {
+			failures.push_back("expected cadence " + toString(scenario.cadenceFrames) + ":" + toString(scenario.cadenceRefreshes));
+		}
+
+		// Emulation time has to track wall time, rounding the cadence must not add up over a minute
+		const double frameError = frames - scenario.coreFps * (vsync - runStart);
+		if (std::abs(frameError) > 2.0) {
+			failures.push_back("drifted by " + toString(frameError, 2) + " frames");
+		}
+
+		// Present intervals only pick up the timestamp jitter of both ends, which has an RMS of jitter * sqrt(2/3)
+		const Time expectedJitter = scenario.jitter * std::sqrt(2.0 / 3.0);
+		if (stats.jitter > expectedJitter * 1.25 + 0.00002) {
+			failures.push_back("jitter above expected " + toString(expectedJitter * 1000.0, 3) + " ms");
+		}
+
+		if (stats.missedVsyncs != dropped) {
+			failures.push_back("expected " + toString(dropped) + " missed vsyncs");
+		}
+		if (stats.cadenceBreaks > 2 * dropped) {
+			failures.push_back("cadence broken");
+		}
+
+		const bool passed = failures.empty();
+		allPassed = allPassed && passed;
+		const auto line = String(scenario.name) + ": " + stats.toString() + " [" + pacer.getCadenceString() + "]";
+		if (passed) {
+			Logger::logInfo("PASS " + line);
+		} else {
+			Logger::logError("FAIL " + line + ": " + String::concat<String>(failures.span(), ", "));
+		}
+	}
+	return allPassed;
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <halley.hpp>
+using namespace Halley;
+
+namespace FramePacerSimulation {
+	// Drives a FramePacer from simulated vsync clocks (common rates, with jitter, drift and missed vsyncs) and checks the
+	// resulting cadence, frame count and jitter stats. Logs each scenario and returns whether all of them passed.
+	bool run();
+}
@@ -1,5 +1,9 @@
 #include "game_canvas.h"
+#include <filesystem>
 
+#include "emulation_thread.h"
+#include "fast_forward_governor.h"
+#include "frame_pacer.h"
 #include "system_bezel.h"
 #include "src/ui/in_game_menu.h"
 #include "src/config/screen_filter_config.h"
@@ -11,9 +15,11 @@
 #include "src/retrograde/retrograde_game.h"
 #include "src/libretro/libretro_core.h"
 #include "src/retrograde/input_mapper.h"
+#include "src/savestate/input_movie.h"
 #include "src/savestate/rewind_data.h"
 #include "src/savestate/savestate.h"
 #include "src/savestate/savestate_collection.h"
+#include "src/util/frame_trace.h"
 
 GameCanvas::GameCanvas(UIFactory& factory, RetrogradeEnvironment& environment, const CoreConfig& coreConfig, const SystemConfig& systemConfig, String gameId, UIWidget& parentMenu)
 	: UIWidget("game_canvas")
@@ -24,9 +30,12 @@ GameCanvas::GameCanvas(UIFactory& factory, RetrogradeEnvironment& environment, c
 	, gameId(std::move(gameId))
 	, parentMenu(parentMenu)
 {
-	rewindData = std::make_unique<RewindData>(16 * 1024 * 1024);
+	rewindData = std::make_unique<RewindData>(16 * 1024 * 1024, true);
 	saveStateCollection = std::make_unique<SaveStateCollection>(environment.getSaveDir(systemConfig.getId()), this->gameId);
 	gameInputMapper = environment.getInputMapper().makeGameInputMapper(systemConfig);
+	runAheadFrames = coreConfig.getRunAheadFrames().value_or(systemConfig.getRunAheadFrames());
+	framePacer = std::make_unique<FramePacer>();
+	fastForward = std::make_unique<FastForwardGovernor>();
 
 	setModal(false);
 
@@ -40,6 +49,7 @@ GameCanvas::GameCanvas(UIFactory& factory, RetrogradeEnvironment& environment, c
 GameCanvas::~GameCanvas()
 {
 	screen = {};
+	emulationThread.reset();
 	saveStateCollection.reset();
 	core.reset();
 	environment.getGame().setTargetFPSOverride(std::nullopt);
@@ -66,9 +76,20 @@ void GameCanvas::startGame(std::optional<std::pair<SaveStateType, size_t>> loadS
 	if (!gameLoaded) {
 		core->loadGame(environment.getRomsDir(systemConfig.getId()) / gameId);
 		gameLoaded = true;
+
+		if (runAheadFrames > 0 && coreConfig.getRunAheadMode() == RunAheadMode::SecondInstance) {
+			if (!core->startSecondInstance()) {
+				Logger::logWarning("Falling back to single instance run-ahead.");
+			}
+		}
+
+		if (coreConfig.hasThreadedEmulation()) {
+			startEmulationThread();
+		}
 	}
 
 	if (loadState) {
+		auto lock = lockCore();
 		const auto result = saveStateCollection->loadGameState(loadState->first, loadState->second);
 		if (result == SaveStateCollection::LoadResult::Failed) {
 			pendingLoadState = loadState;
@@ -139,6 +160,14 @@ void GameCanvas::render(RenderContext& rc) const
 
 	const bool hasCore = coreLoadRequested && coreLoadingFuture.isReady();
 	if (hasCore) {
+		TraceScope trace("present");
+		if (emulationThread) {
+			emulationThread->presentLatestFrame();
+		} else {
+			// Speculative frames from a second instance run-ahead overlap with UI update, and are collected here
+			core->finishRunAhead();
+		}
+
 		const auto canvasRect = Rect4i(getRect());
 		const auto windowRect = environment.getHalleyAPI().video->getWindow().getWindowRect();
 		const float zoom = static_cast<float>(windowRect.getHeight()) / static_cast<float>(canvasRect.getHeight());
@@ -210,17 +239,22 @@ void GameCanvas::stepGame()
 	if (pauseFrames > 0) {
 		--pauseFrames;
 	}
-	core->setPaused(paused);
+	if (emulationThread) {
+		emulationThread->setPaused(paused);
+	} else {
+		core->setPaused(paused);
+	}
 	if (paused) {
 		if (needsPause) {
 			pauseFrames = 3;
 		}
+		framePacer->reset();
 		return;
 	}
 
 	auto& inputAPI = *environment.getHalleyAPI().input;
 
-	if (pendingLoadState) {
+	if (auto lock = lockCore(); pendingLoadState) {
 		const auto result = saveStateCollection->loadGameState(pendingLoadState->first, pendingLoadState->second);
 		pendingLoadStateAttempts++;
 		if (result == SaveStateCollection::LoadResult::Success || pendingLoadStateAttempts > 10) {
@@ -236,59 +270,200 @@ void GameCanvas::stepGame()
 		if (inputAPI.getKeyboard()->isButtonPressed(KeyCode::F4)) {
 			saveStateCollection->loadGameState(SaveStateType::QuickSave, 0);
 		}	
+		if (inputAPI.getKeyboard()->isButtonPressed(KeyCode::F8)) {
+			toggleMovieRecording();
+		}
 	}
 
 	const bool canRewind = systemConfig.hasCapability(SystemCapability::Rewind);
 	const bool rewind = canRewind && inputAPI.getKeyboard()->isButtonDown(KeyCode::F6);
-	const bool ffwd = !rewind && inputAPI.getKeyboard()->isButtonDown(KeyCode::F7);
+	bool ffwd = !rewind && inputAPI.getKeyboard()->isButtonDown(KeyCode::F7);
+	float speed = environment.getSettings().getFastForwardSpeed();
+	if (const auto override = core->getFastForwardOverride()) {
+		// Cores may force fast-forward on, and may also stop the user from toggling it
+		const bool userFfwd = ffwd && !override->inhibit_toggle;
+		ffwd = !rewind && (userFfwd || override->fastforward);
+		if (override->ratio >= 0) {
+			speed = override->ratio;
+		}
+	}
+	ffwdSpeed = speed;
+	core->setFastForwardState(ffwd, speed);
+
+	if (emulationThread) {
+		rewindRequested = rewind;
+		ffwdRequested = ffwd;
+		emulationThread->setFastForwarding(ffwd);
+		core->pollInputDevices(inputSnapshot);
+		emulationThread->pushInput(inputSnapshot);
+	} else if (ffwd) {
+		framePacer->reset();
+		runCore(rewind, ffwd);
+	} else {
+		// Called once per display refresh, the pacer decides how many core frames are due
+		const auto now = std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+		framePacer->setCoreFPS(core->getSystemAVInfo().fps);
+		const int n = framePacer->onVsync(now);
+		for (int i = 0; i < n; ++i) {
+			runCore(rewind, false);
+		}
+
+		if (framePacer->getStats().refreshes >= 10 * framePacer->getRefreshRate()) {
+			Logger::logDev("Frame pacing: " + framePacer->getStats().toString() + " [" + framePacer->getCadenceString() + "]");
+			Logger::logDev("Input latency" + String(coreConfig.hasLateInputLatch() ? " (late latch): " : ": ") + core->getInputLatencyStats().toString());
+			framePacer->resetStats();
+			core->resetInputLatencyStats();
+		}
+	}
+}
+
+void GameCanvas::runCore(bool rewind, bool ffwd)
+{
+	const bool canRewind = systemConfig.hasCapability(SystemCapability::Rewind);
 
 	core->setRewinding(rewind);
 	if (rewind) {
-		const auto bytes = rewindData->popFrame();
-		if (bytes) {
+		TraceScope trace("rewind_restore");
+		const auto snapshot = rewindData->popFrame();
+		if (snapshot) {
 			core->setFastFowarding(false);
-			core->loadState(*bytes);
+			core->loadRewindState(snapshot->state, snapshot->tag);
 			core->runFrame();
 		}
-	} else {
-		// The idea here is to try to do up to 32 frames, but stop short if we're going to exceed 12 ms
-		const int n = ffwd ? 32 : 1;
-		auto frameStartTime = std::chrono::steady_clock::now();
-		Time totalFrameTime = 0.0;
-		Time lastFrameTime = 0.0;
-		const Time maxCPUTime = 0.012; // 12 ms
+	} else if (ffwd) {
+		const auto now = std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+		fastForward->setSpeed(ffwdSpeed);
+		const int n = fastForward->beginDisplayFrame(now, core->getSystemAVInfo().fps);
 
 		for (int i = 0; i < n; ++i) {
-			const bool lastFrame = i == n - 1 || totalFrameTime + 2 * lastFrameTime > maxCPUTime;
+			// Only the last frame of each display frame is shown, the others can skip video and audio
+			const bool lastFrame = fastForward->isLastFrame();
+			const auto frameStartTime = std::chrono::steady_clock::now();
 			core->setFastFowarding(!lastFrame);
 			core->runFrame();
 
-			if (canRewind) {
-				auto save = rewindData->getBuffer(core->getSaveStateSize(LibretroCore::SaveStateType::RewindRecording));
-				const bool ok = core->saveState(LibretroCore::SaveStateType::RewindRecording, gsl::as_writable_bytes(gsl::span<Byte>(save)));
-				if (ok) {
-					rewindData->pushFrame(std::move(save));
-				}
+			// Rewind snapshots are thinned to one per displayed frame
+			if (canRewind && lastFrame) {
+				saveRewindSnapshot();
 			}
 
-			if (ffwd) {
-				if (lastFrame) {
-					break;
-				}
-				const auto now = std::chrono::steady_clock::now();
-				lastFrameTime = std::chrono::duration<double>(now - frameStartTime).count();
-				frameStartTime = now;
-				totalFrameTime += lastFrameTime;
+			fastForward->onFrameRun(std::chrono::duration<double>(std::chrono::steady_clock::now() - frameStartTime).count());
+			if (lastFrame) {
+				break;
 			}
 		}
+	} else {
+		core->setFastFowarding(false);
+		core->runFrameWithRunAhead(runAheadFrames);
+		if (canRewind) {
+			saveRewindSnapshot();
+		}
 	}
 
-	environment.getGame().setTargetFPSOverride(core->getSystemAVInfo().fps);
+	if (!ffwd && fastForward->getStats().displayFrames > 0) {
+		Logger::logDev("Fast-forward: " + fastForward->getStats().toString());
+		fastForward->resetStats();
+		fastForward->reset();
+	}
+}
+
+void GameCanvas::saveRewindSnapshot()
+{
+	TraceScope trace("rewind_snapshot");
+	rewindData->setFrameRate(core->getSystemAVInfo().fps);
+	auto save = rewindData->getBuffer(core->getSaveStateSize(LibretroCore::SaveStateType::RewindRecording));
+	const bool ok = core->saveState(LibretroCore::SaveStateType::RewindRecording, gsl::as_writable_bytes(gsl::span<Byte>(save)));
+	if (ok) {
+		rewindData->pushFrame(std::move(save), core->takeThumbnail(), core->getMoviePosition());
+	}
+
+	// Keyframes get a thumbnail for the rewind timeline, captured from the frame that runs next
+	if (rewindData->isKeyframeDue()) {
+		core->requestThumbnail(256);
+	}
+}
+
+Vector<RewindData::Keyframe> GameCanvas::getRewindKeyframes()
+{
+	auto lock = lockCore();
+	return rewindData->getKeyframes();
+}
+
+bool GameCanvas::seekRewind(uint64_t frameNumber)
+{
+	auto lock = lockCore();
+	TraceScope trace("rewind_seek");
+	const auto snapshot = rewindData->seek(frameNumber);
+	if (!snapshot) {
+		return false;
+	}
+	return core->loadRewindState(snapshot->state, snapshot->tag);
+}
+
+void GameCanvas::toggleMovieRecording()
+{
+	if (core->isRecordingMovie()) {
+		saveMovieRecording();
+	} else {
+		// A recording cut short by loading a state still gets saved
+		saveMovieRecording();
+		if (core->startMovieRecording()) {
+			Logger::logInfo("Recording input movie.");
+		}
+	}
+}
+
+void GameCanvas::saveMovieRecording()
+{
+	auto movie = core->stopMovieRecording();
+	if (!movie || movie->getFrameCount() == 0) {
+		return;
+	}
+
+	const auto timestamp = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+	const auto path = environment.getSaveDir(systemConfig.getId()) / (gameId + "." + toString(timestamp) + ".movie");
+	Logger::logInfo("Saving input movie with " + toString(movie->getFrameCount()) + " frames to " + path.getString());
+
+	Concurrent::execute(Executors::getCPU(), [path, movie = std::move(movie)] ()
+	{
+		const auto dir = path.parentPath().string();
+		std::error_code ec;
+		if (!std::filesystem::is_directory(dir, ec)) {
+			std::filesystem::create_directories(dir, ec);
+		}
+		if (!Path::writeFile(path, movie->toBytes())) {
+			Logger::logError("Failed to save input movie.");
+		}
+	});
+}
+
+void GameCanvas::startEmulationThread()
+{
+	if (core->hasHardwareRendering()) {
+		// Hardware rendered cores need the render context, which lives on the main thread
+		Logger::logWarning("Threaded emulation is not supported with hardware rendered cores.");
+		return;
+	}
+
+	emulationThread = std::make_unique<EmulationThread>(*core, environment.getHalleyAPI(), [=] ()
+	{
+		runCore(rewindRequested, ffwdRequested);
+	});
+}
+
+std::unique_lock<std::mutex> GameCanvas::lockCore()
+{
+	if (emulationThread) {
+		return emulationThread->lock();
+	}
+	return {};
 }
 
 void GameCanvas::close()
 {
+	emulationThread.reset();
 	if (gameLoaded) {
+		saveMovieRecording();
 		saveStateCollection->saveGameState(SaveStateType::Suspend);
 	}
 
@@ -301,6 +476,7 @@ void GameCanvas::close()
 
 void GameCanvas::resetGame()
 {
+	auto lock = lockCore();
 	core->resetGame();
 }
 
@@ -368,6 +544,7 @@ void GameCanvas::updateAutoSave(Time t)
 	if (gameLoaded) {
 		autoSaveTime += t;
 		if (autoSaveTime > 30.0) {
+			auto lock = lockCore();
 			saveStateCollection->saveGameState(SaveStateType::Suspend);
 			autoSaveTime = 0;
 		}
@@ -2,8 +2,10 @@
 
 #include <halley.hpp>
 
+#include "src/libretro/libretro_core.h"
 #include "src/metadata/game_collection.h"
 #include "src/retrograde/game_input_mapper.h"
+#include "src/savestate/rewind_data.h"
 #include "src/ui/in_game_menu.h"
 enum class SaveStateType;
 class SaveStateCollection;
@@ -12,12 +14,12 @@ class CoreConfig;
 class SystemBezel;
 class SystemConfig;
 class FilterChain;
-class RewindData;
 class RetrogradeEnvironment;
+class EmulationThread;
+class FastForwardGovernor;
+class FramePacer;
 using namespace Halley;
 
-class LibretroCore;
-
 class GameCanvas : public UIWidget {
 public:
     GameCanvas(UIFactory& factory, RetrogradeEnvironment& environment, const CoreConfig& coreConfig, const SystemConfig& systemConfig, String gameId, UIWidget& parentMenu);
@@ -36,6 +38,8 @@ public:
 
     SaveStateCollection& getSaveStateCollection();
     GameInputMapper& getGameInputMapper();
+    Vector<RewindData::Keyframe> getRewindKeyframes();
+    bool seekRewind(uint64_t frameNumber);
 
     void waitForCoreLoad();
     bool isCoreLoaded() const;
@@ -50,6 +54,9 @@ private:
     UIWidget& parentMenu;
 
 	std::unique_ptr<LibretroCore> core;
+	std::unique_ptr<EmulationThread> emulationThread;
+	std::unique_ptr<FramePacer> framePacer;
+	std::unique_ptr<FastForwardGovernor> fastForward;
 	std::unique_ptr<RewindData> rewindData;
 	std::unique_ptr<SaveStateCollection> saveStateCollection;
     std::shared_ptr<GameInputMapper> gameInputMapper;
@@ -60,10 +67,15 @@ private:
 
     int frames = 0;
     int pauseFrames = 0;
+    int runAheadFrames = 0;
     mutable int pendingCloseState = 0;
     bool coreLoadRequested = false;
     bool gameLoaded = false;
     bool mouseCaptured = false;
+    std::atomic<bool> rewindRequested = false;
+    std::atomic<bool> ffwdRequested = false;
+    std::atomic<float> ffwdSpeed = 0;
+    LibretroCore::InputSnapshot inputSnapshot;
     Future<void> coreLoadingFuture;
 
     std::optional<std::pair<SaveStateType, size_t>> pendingLoadState;
@@ -78,6 +90,12 @@ private:
 	void paint(Painter& painter) const;
     void drawScreen(Painter& painter, Sprite screen) const;
     void stepGame();
+    void runCore(bool rewind, bool ffwd);
+    void saveRewindSnapshot();
+    void toggleMovieRecording();
+    void saveMovieRecording();
+    void startEmulationThread();
+    std::unique_lock<std::mutex> lockCore();
 
     void onGamepadInput(const UIInputResults& input, Time time) override;
 
@@ -2,6 +2,7 @@
 
 #include "src/config/bezel_config.h"
 #include "src/retrograde/retrograde_environment.h"
+#include "src/util/frame_trace.h"
 #include "src/util/image_cache.h"
 
 SystemBezel::SystemBezel(const RetrogradeEnvironment& env)
@@ -45,6 +46,7 @@ Vector2f SystemBezel::update(Rect4i windowSize, Rect4i canvasSize, Vector2f canv
 
 void SystemBezel::draw(Painter& painter, BezelLayer layer) const
 {
+	TraceScope trace(layer == BezelLayer::Background ? "bezel_draw_background" : "bezel_draw_foreground");
 	for (auto& image: images) {
 		if (image.sprite.hasMaterial() && image.layer == layer) {
 			image.sprite.draw(painter);
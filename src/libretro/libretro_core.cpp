@@ -9,9 +9,14 @@
 #include "libretro_vfs.h"
 #include "src/config/core_config.h"
 #include "src/retrograde/retrograde_game.h"
+#include "src/savestate/input_movie.h"
+#include "src/util/audio_convert.h"
 #include "src/util/cpu_update_texture.h"
 #include "src/util/c_string_cache.h"
+#include "src/util/frame_trace.h"
 #include "src/util/opengl_interop.h"
+#include "src/util/pixel_convert.h"
+#include "src/util/worker_thread.h"
 
 #ifdef _WIN32
 #define UUID_DEFINED
@@ -27,43 +32,54 @@
 #include "libretro_vulkan.h"
 #endif
 
-ILibretroCoreCallbacks* ILibretroCoreCallbacks::curInstance = nullptr;
-size_t ILibretroCoreCallbacks::curInstanceDepth = 0;
+thread_local ILibretroCoreCallbacks* ILibretroCoreCallbacks::curInstance = nullptr;
+thread_local size_t ILibretroCoreCallbacks::curInstanceDepth = 0;
+std::atomic<ILibretroCoreCallbacks*> ILibretroCoreCallbacks::lastInstance = nullptr;
+
+thread_local std::array<std::optional<ProfilerEvent>, LibretroCore::maxPerfEventDepth> LibretroCore::perfEvents;
+thread_local std::array<retro_perf_counter*, LibretroCore::maxPerfEventDepth> LibretroCore::perfEventCounters;
+thread_local size_t LibretroCore::perfEventDepth = 0;
+thread_local bool LibretroCore::insideRetroRun = false;
+
+ILibretroCoreCallbacks& ILibretroCoreCallbacks::getCurrentInstance()
+{
+	return curInstance ? *curInstance : *lastInstance.load();
+}
 
 namespace {
 	bool RETRO_CALLCONV retroEnvironmentCallback(uint32_t cmd, void *data)
 	{
-		return ILibretroCoreCallbacks::curInstance->onEnvironment(cmd, data);
+		return ILibretroCoreCallbacks::getCurrentInstance().onEnvironment(cmd, data);
 	}
 	
 	void RETRO_CALLCONV retroVideoRefreshCallback(const void *data, uint32_t width, uint32_t height, size_t pitch)
 	{
-		ILibretroCoreCallbacks::curInstance->onVideoRefresh(data, width, height, pitch);
+		ILibretroCoreCallbacks::getCurrentInstance().onVideoRefresh(data, width, height, pitch);
 	}
 	
 	void RETRO_CALLCONV retroAudioSampleCallback(int16_t left, int16_t right)
 	{
-		ILibretroCoreCallbacks::curInstance->onAudioSample(left, right);
+		ILibretroCoreCallbacks::getCurrentInstance().onAudioSample(left, right);
 	}
 	
 	size_t RETRO_CALLCONV retroAudioSampleBatchCallback(const int16_t *data, size_t frames)
 	{
-		return ILibretroCoreCallbacks::curInstance->onAudioSampleBatch(data, frames);
+		return ILibretroCoreCallbacks::getCurrentInstance().onAudioSampleBatch(data, frames);
 	}
 	
 	void RETRO_CALLCONV retroInputPollCallback()
 	{
-		return ILibretroCoreCallbacks::curInstance->onInputPoll();
+		return ILibretroCoreCallbacks::getCurrentInstance().onInputPoll();
 	}
 	
 	int16_t RETRO_CALLCONV retroInputStateCallback(uint32_t port, uint32_t device, uint32_t index, uint32_t id)
 	{
-		return ILibretroCoreCallbacks::curInstance->onInputState(port, device, index, id);
+		return ILibretroCoreCallbacks::getCurrentInstance().onInputState(port, device, index, id);
 	}
 
 	void RETRO_CALLCONV retroSetLEDState(int led, int state)
 	{
-		return ILibretroCoreCallbacks::curInstance->onSetLEDState(led, state);
+		return ILibretroCoreCallbacks::getCurrentInstance().onSetLEDState(led, state);
 	}
 
 	void RETRO_CALLCONV retroLogPrintf(retro_log_level level, const char *fmt, ...)
@@ -74,24 +90,24 @@ namespace {
 		va_start(args, fmt);
 		int n = vsprintf_s(buffer, sizeof(buffer), fmt, args);
 		if (n > 0) {
-			ILibretroCoreCallbacks::curInstance->onLog(level, buffer);
+			ILibretroCoreCallbacks::getCurrentInstance().onLog(level, buffer);
 		}
 		va_end(args);
 	}
 
 	uintptr_t RETRO_CALLCONV retroHWGetCurrentFramebuffer()
 	{
-		return ILibretroCoreCallbacks::curInstance->onHWGetCurrentFrameBuffer();
+		return ILibretroCoreCallbacks::getCurrentInstance().onHWGetCurrentFrameBuffer();
 	}
 
 	retro_proc_address_t RETRO_CALLCONV retroHWGetProcAddress(const char* sym)
 	{
-		return ILibretroCoreCallbacks::curInstance->onHWGetProcAddress(sym);
+		return ILibretroCoreCallbacks::getCurrentInstance().onHWGetProcAddress(sym);
 	}
 
 	bool RETRO_CALLCONV retroSetRumbleState(uint32_t port, retro_rumble_effect effect, uint16_t strength)
 	{
-		return ILibretroCoreCallbacks::curInstance->onSetRumbleState(port, effect, strength);
+		return ILibretroCoreCallbacks::getCurrentInstance().onSetRumbleState(port, effect, strength);
 	}
 
 	uint64_t retroGetCpuFeatures()
@@ -118,24 +134,24 @@ namespace {
 		return getDuration();
 	}
 
-	void retroPerfLog()
+	void RETRO_CALLCONV retroPerfLog()
 	{
-		// TODO?
+		ILibretroCoreCallbacks::getCurrentInstance().onPerfLog();
 	}
 
-	void retroPerfRegister(retro_perf_counter* counter)
+	void RETRO_CALLCONV retroPerfRegister(retro_perf_counter* counter)
 	{
-		// TODO?
+		ILibretroCoreCallbacks::getCurrentInstance().onPerfRegister(counter);
 	}
 
-	void retroPerfStart(retro_perf_counter* counter)
+	void RETRO_CALLCONV retroPerfStart(retro_perf_counter* counter)
 	{
-		// TODO?
+		ILibretroCoreCallbacks::getCurrentInstance().onPerfStart(counter);
 	}
 
-	void retroPerfStop(retro_perf_counter* counter)
+	void RETRO_CALLCONV retroPerfStop(retro_perf_counter* counter)
 	{
-		// TODO?
+		ILibretroCoreCallbacks::getCurrentInstance().onPerfStop(counter);
 	}
 
 #ifdef WITH_DX11
@@ -184,6 +200,11 @@ bool LibretroCore::ControllerType::operator!=(const ControllerType& other) const
 	return !(id == other.id && desc == other.desc);
 }
 
+Time LibretroCore::RunAheadTiming::getTotal() const
+{
+	return realFrame + saveState + hiddenFrames + loadState;
+}
+
 bool LibretroCore::PortControllerTypes::operator==(const PortControllerTypes& other) const
 {
 	return types == other.types && curTypeIdx == other.curTypeIdx;
@@ -214,6 +235,10 @@ LibretroCore::LibretroCore(DLL dll, const CoreConfig& coreConfig, String systemI
 	, environment(environment)
 	, systemId(std::move(systemId))
 {
+	// Preallocate the buffers on the audio path, so the core's callbacks don't touch the heap
+	audioPending.resize(64 * 1024);
+	audioConvertBuffer.resize(8 * 1024);
+
 	init();
 }
 
@@ -251,7 +276,15 @@ void LibretroCore::init()
 
 void LibretroCore::initVideoOut()
 {
+	if (!environment.getHalleyAPI().video) {
+		// Headless, frames are still produced by the core but discarded
+		return;
+	}
+
 	cpuUpdateTexture = std::make_unique<CPUUpdateTexture>(*environment.getHalleyAPI().video);
+
+	// Only the DX11 backend supports the 16-bit and BGRX formats natively
+	convertPixelFormat = environment.getHalleyAPI().video->getShaderLanguage() != "hlsl";
 	auto material = std::make_shared<Material>(environment.getResources().get<MaterialDefinition>("Halley/SpriteOpaque"));
 
 	videoOut
@@ -263,8 +296,18 @@ void LibretroCore::initVideoOut()
 
 void LibretroCore::initAudioOut()
 {
+	if (isSecondInstance) {
+		// Audio is hard disabled on the second instance
+		return;
+	}
+
+	if (!environment.getHalleyAPI().audio) {
+		// Headless, samples are still converted and queued, but never played
+		return;
+	}
+
 	if (!audioThread) {
-		audioThread = std::make_shared<SingleThreadExecutor>("libretro_audio", [=](String name, std::function<void()> f) {
+		audioThread = std::make_unique<WorkerThread>("libretro_audio", [=](String name, std::function<void()> f) {
 			return environment.getHalleyAPI().system->createThread(name, ThreadPriority::High, std::move(f));
 		});
 	}
@@ -278,20 +321,117 @@ void LibretroCore::initAudioOut()
 
 void LibretroCore::addAudioSamples(gsl::span<const float> samples)
 {
-	Vector<float> buffer;
-	buffer.resize(samples.size());
-	memcpy(buffer.data(), samples.data(), samples.size_bytes());
-	const auto sampleRate = systemAVInfo.sampleRate;
-	
+	// Staged until the end of the frame. If the buffer is full, samples are dropped, which beats stalling the core
+	const size_t n = std::min(samples.size(), audioPending.size() - audioPendingCount);
+	std::copy_n(samples.begin(), n, audioPending.begin() + audioPendingCount);
+	audioPendingCount += n;
+}
+
+void LibretroCore::flushAudio()
+{
+	TraceScope trace("audio_enqueue");
+	auto lock = lockAudio();
+
+	if (audioSampleCount > 0) {
+		addAudioSamples(gsl::span<const float>(audioSampleBuffer.data(), audioSampleCount));
+		audioSampleCount = 0;
+	}
+
+	if (audioPendingCount == 0) {
+		return;
+	}
+
+	const auto sampleRate = static_cast<float>(systemAVInfo.sampleRate);
 	constexpr float maxPitchShift = 0.01f;
-	const auto span = gsl::span<const float>(buffer.data(), buffer.size());
+
 	if (audioOut) {
-		audioOut->addInterleavedSamplesWithResampleSync(span, static_cast<float>(sampleRate), maxPitchShift, *environment.getHalleyAPI().core, *environment.getHalleyAPI().audioOutput);
+		const auto span = gsl::span<const float>(audioPending.data(), audioPendingCount);
+		audioOut->addInterleavedSamplesWithResampleSync(span, sampleRate, maxPitchShift, *environment.getHalleyAPI().core, *environment.getHalleyAPI().audioOutput);
+	}
+	audioPendingCount = 0;
+}
+
+std::unique_lock<std::mutex> LibretroCore::lockAudio()
+{
+	// With an audio callback, the core can produce audio from the audio thread as well as from retro_run
+	if (audioCallback) {
+		return std::unique_lock<std::mutex>(audioMutex);
+	}
+	return {};
+}
+
+void LibretroCore::startAudioCallback()
+{
+	if (!audioCallback || !audioOut || audioCallbackRunning) {
+		return;
+	}
+
+	audioCallbackRunning = true;
+	audioCallbackActive = !paused;
+	if (audioCallbackActive && audioCallback->set_state) {
+		audioCallback->set_state(true);
+	}
+
+	audioThread->post([=] ()
+	{
+		runAudioCallback();
+	});
+}
+
+void LibretroCore::stopAudioCallback()
+{
+	if (!audioCallbackRunning) {
+		return;
+	}
+
+	{
+		std::unique_lock<std::mutex> lock(audioCallbackWakeMutex);
+		audioCallbackRunning = false;
+	}
+	audioCallbackWake.notify_all();
+	audioThread->wait();
+
+	if (audioCallbackActive && audioCallback->set_state) {
+		audioCallback->set_state(false);
+	}
+	audioCallbackActive = false;
+}
+
+void LibretroCore::runAudioCallback()
+{
+	auto guard = ScopedGuard([=]() { popInstance(); });
+	pushInstance();
+
+	// Pull model: ask the core for more audio whenever the output drops below its latency target
+	while (audioCallbackRunning) {
+		const size_t samplesLeft = audioOut->getSamplesLeft();
+		const size_t latencyTarget = audioOut->getLatencyTarget();
+		if (audioCallbackActive && samplesLeft < latencyTarget) {
+			{
+				ProfilerEvent event(ProfilerEventType::ExternalCode);
+				audioCallback->callback();
+			}
+			flushAudio();
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(audioCallbackWakeMutex);
+		if (audioCallbackActive) {
+			// Sleep until the device should have played the buffer down to the target, unless paused or stopped first
+			const auto excess = static_cast<int64_t>(samplesLeft - latencyTarget + 1);
+			const auto timeout = std::chrono::microseconds(excess * 1'000'000 / AudioConfig::sampleRate);
+			audioCallbackWake.wait_for(lock, timeout, [&] { return !audioCallbackRunning || !audioCallbackActive; });
+		} else {
+			// Nothing to produce while paused, so wait for setPaused or stopAudioCallback
+			audioCallbackWake.wait(lock, [&] { return !audioCallbackRunning || audioCallbackActive; });
+		}
 	}
 }
 
 void LibretroCore::deInit()
 {
+	stopSecondInstance();
+
 	unloadGame();
 
 	auto guard = ScopedGuard([=]() { popInstance(); });
@@ -300,12 +440,26 @@ void LibretroCore::deInit()
 	glFramebuffer.reset();
 	glInterop.reset();
 
+	// Counters live in the core's memory, so this has to happen before it goes away
+	logPerfCounters();
+	{
+		std::unique_lock<std::mutex> lock(perfCountersMutex);
+		for (auto& stats: perfCounters) {
+			// So they register again if the core is initialised again without being unloaded
+			stats.counter->registered = false;
+		}
+		perfCounters.clear();
+	}
+
 	DLL_FUNC(dll, retro_deinit)();
 
 	audioBufferStatusCallback = nullptr;
+	audioCallback.reset();
 	audioThread.reset();
 	audioOut.reset();
-	environment.getHalleyAPI().audio->setBufferSizeController({});
+	if (!isSecondInstance && environment.getHalleyAPI().audio) {
+		environment.getHalleyAPI().audio->setBufferSizeController({});
+	}
 
 	hwRenderCallback.reset();
 	hwRenderInterface.reset();
@@ -313,10 +467,15 @@ void LibretroCore::deInit()
 	diskControlCallbacks.reset();
 	vfs.reset();
 
-	environment.getGame().setTargetFPSOverride(std::nullopt);
+	if (!isSecondInstance) {
+		environment.getGame().setTargetFPSOverride(std::nullopt);
+	}
 
 	dll.unload();
 
+	ILibretroCoreCallbacks* self = this;
+	lastInstance.compare_exchange_strong(self, nullptr);
+
 	Logger::logDev("Core unloaded.");
 }
 
@@ -353,6 +512,7 @@ bool LibretroCore::loadGame(const Path& path)
 		unloadGame();
 	}
 	gameName = Path(path).getFilename().replaceExtension("").getString();
+	gamePath = path;
 
 	CStringCache cache;
 
@@ -419,9 +579,10 @@ bool LibretroCore::loadGame(const Path& path)
 		gameBytes.clear();
 	}
 
-	if (gameLoaded) {
+	if (gameLoaded && audioOut) {
 		auto& audio = *environment.getHalleyAPI().audio;
 		audioStreamHandle = audio.play(audioOut, audio.getGlobalEmitter(), 1, true);
+		startAudioCallback();
 	}
 
 	return gameLoaded;
@@ -471,6 +632,9 @@ bool LibretroCore::doLoadGame()
 void LibretroCore::unloadGame()
 {
 	if (gameLoaded) {
+		stopAudioCallback();
+		stopMoviePlayback();
+
 		auto guard = ScopedGuard([=]() { popInstance(); });
 		pushInstance();
 
@@ -478,6 +642,10 @@ void LibretroCore::unloadGame()
 
 		gameLoaded = false;
 		lastSaveHash = 0;
+		{
+			std::unique_lock<std::mutex> lock(fastForwardOverrideMutex);
+			fastForwardOverride.reset();
+		}
 		gameInfos.clear();
 		gameBytes.clear();
 
@@ -489,6 +657,13 @@ void LibretroCore::unloadGame()
 			audioStreamHandle->stop();
 		}
 		audioOut.reset();
+
+		if (cpuUpdateTexture && cpuUpdateTexture->getStats().frames > 0) {
+			Logger::logDev("Video upload: " + cpuUpdateTexture->getStats().toString());
+		}
+		if (inputLatencyStats.polls > 0) {
+			Logger::logDev("Input latency: " + inputLatencyStats.toString());
+		}
 	}
 }
 
@@ -501,10 +676,15 @@ void LibretroCore::resetGame()
 
 void LibretroCore::runFrame()
 {
+	const auto frameStart = FrameTrace::now();
+
+	// Make sure any speculative frame is presented before this one
+	finishRunAhead();
+
 	auto guard = ScopedGuard([=]() { popInstance(); });
 	pushInstance();
 
-	if (audioBufferStatusCallback) {
+	if (audioBufferStatusCallback && audioOut) {
 		const size_t nLeft = audioOut->getSamplesLeft();
 		const size_t capacity = audioOut->getLatencyTarget() * 2;
 		audioBufferStatusCallback(true, clamp(static_cast<int>(nLeft * 100 / capacity), 0, 100), nLeft < 400);
@@ -523,20 +703,301 @@ void LibretroCore::runFrame()
 		dx11State->load(*environment.getHalleyAPI().video);
 	}
 
+	// Hidden run-ahead frames get rolled back, so only real frames count towards a movie
+	const bool movieFrame = !runningHiddenFrame && !isSecondInstance;
+	if (moviePlayback && movieFrame && !moviePlayback->beginPlaybackFrame()) {
+		stopMoviePlayback();
+	}
+
+	int64_t coreTime = 0;
 	{
 		ProfilerEvent event(ProfilerEventType::ExternalCode);
+		TraceScope trace(isSecondInstance ? "retro_run_ahead" : "retro_run");
+		callbackTime = 0;
+		insideRetroRun = true;
+		const auto runStart = FrameTrace::now();
 		DLL_FUNC(dll, retro_run)();
+		insideRetroRun = false;
+		coreTime = FrameTrace::now() - runStart - callbackTime;
 	}
 	
 	if (dx11State) {
 		dx11State->save(*environment.getHalleyAPI().video);
 	}
 
-	if (!coreHandlesSaveData) {
+	if (movieFrame) {
+		if (movieRecording && !movieRecordingStopped) {
+			movieRecording->endRecordedFrame();
+		}
+		if (moviePlayback) {
+			moviePlayback->endPlaybackFrame();
+			if (!moviePlayback->hasPlaybackFramesLeft()) {
+				Logger::logDev("Input movie playback finished after " + toString(moviePlayback->getFrameCount()) + " frames.");
+				stopMoviePlayback();
+			}
+		}
+	}
+
+	if (!coreHandlesSaveData && !runningHiddenFrame && !isSecondInstance) {
 		saveGameDataIfNeeded();
 	}
 
+	flushAudio();
+	updatePerfCounters();
 	stringCache.clear();
+
+	lastFrameTiming.core = static_cast<Time>(coreTime) / 1'000'000'000.0;
+	lastFrameTiming.frontend = static_cast<Time>(FrameTrace::now() - frameStart - coreTime) / 1'000'000'000.0;
+}
+
+void LibretroCore::runFrameWithRunAhead(int frames)
+{
+	if (frames <= 0 || runAheadFailed) {
+		runFrame();
+		return;
+	}
+
+	if (secondInstance) {
+		runFrameWithSecondInstance(frames);
+		return;
+	}
+
+	using Clock = std::chrono::steady_clock;
+	auto elapsed = [](Clock::time_point& t) -> Time
+	{
+		const auto now = Clock::now();
+		const auto result = std::chrono::duration<double>(now - t).count();
+		t = now;
+		return result;
+	};
+
+	RunAheadTiming timing;
+	auto t = Clock::now();
+
+	// Run the real frame, with audio, but don't show it
+	setAudioVideoEnabled(false, true);
+	runFrame();
+	setAudioVideoEnabled(true, true);
+	timing.realFrame = elapsed(t);
+
+	// Snapshot it
+	runAheadState.resize(getSaveStateSize(SaveStateType::RunaheadSameInstance));
+	if (!saveState(SaveStateType::RunaheadSameInstance, gsl::as_writable_bytes(gsl::span<Byte>(runAheadState)))) {
+		// The previous output stays on screen for this frame, the next one runs without run-ahead
+		Logger::logWarning("Core failed to serialize for run-ahead, disabling it.");
+		runAheadFailed = true;
+		return;
+	}
+	timing.saveState = elapsed(t);
+
+	// Run the hidden frames, only presenting the last one
+	runningHiddenFrame = true;
+	for (int i = 0; i < frames; ++i) {
+		setAudioVideoEnabled(i == frames - 1, false);
+		runFrame();
+	}
+	runningHiddenFrame = false;
+	setAudioVideoEnabled(true, true);
+	timing.hiddenFrames = elapsed(t);
+
+	// Roll back to the real frame
+	if (!loadState(SaveStateType::RunaheadSameInstance, gsl::as_bytes(gsl::span<const Byte>(runAheadState)))) {
+		Logger::logWarning("Core failed to unserialize for run-ahead, disabling it.");
+		runAheadFailed = true;
+	}
+	timing.loadState = elapsed(t);
+
+	onRunAheadTiming(timing, frames);
+}
+
+bool LibretroCore::startSecondInstance()
+{
+	if (secondInstance) {
+		return true;
+	}
+	if (!gameLoaded || hwRenderCallback) {
+		Logger::logWarning("Second instance run-ahead is only supported on software rendered cores.");
+		return false;
+	}
+
+	// The OS won't load the same library twice, so load a copy of it instead
+	const auto srcPath = Path(dll.getFilename());
+	const auto dstPath = environment.getCoresDir() / "secondary" / srcPath.getFilename();
+	std::error_code ec;
+	std::filesystem::create_directories(dstPath.parentPath().getNativeString().cppStr(), ec);
+	std::filesystem::copy_file(srcPath.getNativeString().cppStr(), dstPath.getNativeString().cppStr(), std::filesystem::copy_options::update_existing, ec);
+	if (ec) {
+		Logger::logError("Failed to copy core for second instance: " + String(ec.message()));
+		return false;
+	}
+
+	auto instance = load(coreConfig, dstPath.getNativeString(), systemId, environment);
+	if (!instance) {
+		Logger::logError("Failed to load second instance of core.");
+		return false;
+	}
+	instance->isSecondInstance = true;
+	instance->externalInput = true;
+	for (const auto& [k, v]: options) {
+		instance->setOption(k, v.value);
+	}
+	if (!instance->loadGame(gamePath)) {
+		Logger::logError("Failed to load game on second instance of core.");
+		return false;
+	}
+	for (size_t i = 0; i < controllerTypes.size() && i < instance->controllerTypes.size(); ++i) {
+		instance->setControllerType(static_cast<int>(i), controllerTypes[i].curTypeIdx);
+	}
+	instance->setVideoCapture(&runAheadFrame);
+
+	secondInstance = std::move(instance);
+	runAheadWorker = std::make_unique<WorkerThread>("libretro_runahead", [=](String name, std::function<void()> f) {
+		return environment.getHalleyAPI().system->createThread(name, ThreadPriority::High, std::move(f));
+	});
+
+	Logger::logDev("Started second instance for run-ahead.");
+	return true;
+}
+
+void LibretroCore::runFrameWithSecondInstance(int frames)
+{
+	finishRunAhead();
+	if (!secondInstance) {
+		// Finishing the last frame found that the second instance can't keep up with this one
+		runFrameWithRunAhead(frames);
+		return;
+	}
+
+	using Clock = std::chrono::steady_clock;
+	auto elapsed = [](Clock::time_point& t) -> Time
+	{
+		const auto now = Clock::now();
+		const auto result = std::chrono::duration<double>(now - t).count();
+		t = now;
+		return result;
+	};
+
+	RunAheadTiming timing;
+	auto t = Clock::now();
+
+	// Run the real frame on this instance, with audio but without video
+	setAudioVideoEnabled(false, true);
+	runFrame();
+	setAudioVideoEnabled(true, true);
+	timing.realFrame = elapsed(t);
+
+	runAheadState.resize(getSaveStateSize(SaveStateType::RunaheadSameBinary));
+	if (!saveState(SaveStateType::RunaheadSameBinary, gsl::as_writable_bytes(gsl::span<Byte>(runAheadState)))) {
+		// The previous output stays on screen for this frame, the next one runs without run-ahead
+		Logger::logWarning("Core failed to serialize for run-ahead, disabling it.");
+		runAheadFailed = true;
+		return;
+	}
+	timing.saveState = elapsed(t);
+
+	// Sync the second instance and run ahead on it, in the background
+	secondInstance->setInputSnapshot(inputs);
+	pendingRunAheadTiming = timing;
+	pendingRunAheadFrames = frames;
+	runAheadPending = true;
+
+	runAheadWorker->post([this, frames, elapsed] ()
+	{
+		auto t = Clock::now();
+		auto& instance = *secondInstance;
+
+		if (!instance.loadState(SaveStateType::RunaheadSameBinary, gsl::as_bytes(gsl::span<const Byte>(runAheadState)))) {
+			secondInstanceFailed = true;
+			return;
+		}
+		pendingRunAheadTiming.loadState = elapsed(t);
+
+		for (int i = 0; i < frames; ++i) {
+			instance.setAudioVideoEnabled(i == frames - 1, false);
+			instance.runFrame();
+		}
+		pendingRunAheadTiming.hiddenFrames = elapsed(t);
+	});
+}
+
+void LibretroCore::finishRunAhead()
+{
+	if (!runAheadPending) {
+		return;
+	}
+	runAheadPending = false;
+
+	runAheadWorker->wait();
+	if (secondInstanceFailed) {
+		// Its last frame is stale, so keep the previous output for this frame
+		Logger::logWarning("Second instance failed to unserialize for run-ahead, falling back to single instance run-ahead.");
+		stopSecondInstance();
+		return;
+	}
+
+	outputVideoFrame(runAheadFrame);
+	onRunAheadTiming(pendingRunAheadTiming, pendingRunAheadFrames);
+}
+
+void LibretroCore::stopSecondInstance()
+{
+	runAheadWorker.reset();
+	secondInstance.reset();
+	secondInstanceFailed = false;
+}
+
+void LibretroCore::outputVideoFrame(const VideoFrame& frame)
+{
+	if (videoCapture) {
+		*videoCapture = frame;
+	} else {
+		presentVideoFrame(frame);
+	}
+}
+
+const LibretroCore::RunAheadTiming& LibretroCore::getRunAheadTiming() const
+{
+	return runAheadTiming;
+}
+
+const LibretroCore::FrameTiming& LibretroCore::getLastFrameTiming() const
+{
+	return lastFrameTiming;
+}
+
+void LibretroCore::onRunAheadTiming(const RunAheadTiming& timing, int frames)
+{
+	runAheadTiming = timing;
+
+	runAheadTimingAccumulated.realFrame += timing.realFrame;
+	runAheadTimingAccumulated.saveState += timing.saveState;
+	runAheadTimingAccumulated.hiddenFrames += timing.hiddenFrames;
+	runAheadTimingAccumulated.loadState += timing.loadState;
+	++runAheadTimingFrames;
+
+	// Log the average every ~10 seconds
+	if (runAheadTimingFrames >= static_cast<int>(systemAVInfo.fps * 10)) {
+		const auto n = static_cast<Time>(runAheadTimingFrames);
+		auto ms = [&](Time value) { return toString(value * 1000.0 / n, 2); };
+		const auto& acc = runAheadTimingAccumulated;
+		Logger::logDev("Run-ahead (" + toString(frames) + " frames): " + ms(acc.getTotal()) + " ms/frame [real " + ms(acc.realFrame) + ", save " + ms(acc.saveState) + ", hidden " + ms(acc.hiddenFrames) + ", load " + ms(acc.loadState) + "]");
+
+		runAheadTimingAccumulated = {};
+		runAheadTimingFrames = 0;
+	}
+}
+
+void LibretroCore::addCallbackTime(int64_t startTime)
+{
+	if (insideRetroRun) {
+		callbackTime += FrameTrace::now() - startTime;
+	}
+}
+
+void LibretroCore::setAudioVideoEnabled(bool video, bool audio)
+{
+	videoEnabled = video;
+	audioEnabled = audio;
 }
 
 bool LibretroCore::hasGameLoaded() const
@@ -586,11 +1047,7 @@ bool LibretroCore::saveState(SaveStateType type, gsl::span<gsl::byte> bytes) con
 
 bool LibretroCore::loadState(gsl::span<const gsl::byte> bytes)
 {
-	auto guard = ScopedGuard([=]() { popInstance(); });
-	pushInstance();
-
-	saveStateType = SaveStateType::Normal;
-	return DLL_FUNC(dll, retro_unserialize)(bytes.data(), bytes.size());
+	return loadState(SaveStateType::Normal, bytes);
 }
 
 bool LibretroCore::loadState(const Bytes& bytes)
@@ -598,6 +1055,31 @@ bool LibretroCore::loadState(const Bytes& bytes)
 	return loadState(gsl::as_bytes(gsl::span<const Byte>(bytes)));
 }
 
+bool LibretroCore::loadState(SaveStateType type, gsl::span<const gsl::byte> bytes)
+{
+	if (type == SaveStateType::Normal) {
+		// Whatever this state is, the movie's inputs no longer line up with it
+		if (movieRecording && !movieRecordingStopped) {
+			Logger::logWarning("Loaded a state while recording an input movie, the recording ends here.");
+			movieRecordingStopped = true;
+		}
+		stopMoviePlayback();
+	}
+
+	return unserializeState(type, bytes);
+}
+
+bool LibretroCore::unserializeState(SaveStateType type, gsl::span<const gsl::byte> bytes)
+{
+	auto guard = ScopedGuard([=]() { popInstance(); });
+	pushInstance();
+
+	saveStateType = type;
+	const bool ok = DLL_FUNC(dll, retro_unserialize)(bytes.data(), bytes.size());
+	saveStateType = SaveStateType::Normal;
+	return ok;
+}
+
 gsl::span<Byte> LibretroCore::getMemory(MemoryType type)
 {
 	int id = 0;
@@ -634,12 +1116,36 @@ void LibretroCore::setFastFowarding(bool ffwd)
 	fastForwarding = ffwd;
 }
 
+void LibretroCore::setFastForwardState(bool active, float speed)
+{
+	fastForwardActive = active;
+	fastForwardSpeed = speed;
+}
+
+std::optional<retro_fastforwarding_override> LibretroCore::getFastForwardOverride() const
+{
+	std::unique_lock<std::mutex> lock(fastForwardOverrideMutex);
+	return fastForwardOverride;
+}
+
 void LibretroCore::setPaused(bool paused)
 {
 	this->paused = paused;
 	if (audioOut) {
 		audioOut->setPaused(paused);
 	}
+
+	const bool active = audioCallbackRunning && !paused;
+	if (audioCallbackActive != active) {
+		{
+			std::unique_lock<std::mutex> lock(audioCallbackWakeMutex);
+			audioCallbackActive = active;
+		}
+		audioCallbackWake.notify_all();
+		if (audioCallback->set_state) {
+			audioCallback->set_state(active);
+		}
+	}
 }
 
 void LibretroCore::saveGameDataIfNeeded()
@@ -703,25 +1209,49 @@ const Sprite& LibretroCore::getVideoOut() const
 	return videoOut;
 }
 
-std::unique_ptr<Image> LibretroCore::getLastScreenImage() const
+Future<std::shared_ptr<Image>> LibretroCore::getLastScreenImage() const
 {
+	TraceScope trace("screenshot_capture");
+
+	if (lastFrameIsCPU && cpuUpdateTexture) {
+		if (const auto frame = cpuUpdateTexture->getCurrentFrame()) {
+			// The staging copy is still the shown frame, so no GPU readback is needed. Only the copy happens here.
+			const auto format = frame->format == TextureFormat::RGBA ? PixelConvert::Format::XBGR8888 : getPixelConvertFormat(systemAVInfo.pixelFormat);
+			Bytes pixels;
+			pixels.resize(frame->pixels.size());
+			memcpy(pixels.data(), frame->pixels.data(), pixels.size());
+
+			return Concurrent::execute(Executors::getCPU(), [pixels = std::move(pixels), size = frame->size, stride = frame->stride, format] () -> std::shared_ptr<Image>
+			{
+				TraceScope trace("screenshot_convert");
+				auto img = std::make_shared<Image>(Image::Format::RGBA, size, false);
+				PixelConvert::toRGBA8(format, gsl::as_bytes(gsl::span<const Byte>(pixels)), static_cast<size_t>(stride), gsl::as_writable_bytes(img->getPixels4BPP()), static_cast<size_t>(size.x) * 4, size);
+				return img;
+			});
+		}
+	}
+
 	if (!videoOut.hasMaterial() || !videoOut.getMaterial().getTexture(0)) {
-		return {};
+		return Concurrent::execute(Executors::getImmediate(), [] () { return std::shared_ptr<Image>(); });
 	}
 	const auto tex = videoOut.getMaterial().getTexture(0);
 	Painter* painter = nullptr;
 
-	auto img = std::make_unique<Image>(Image::Format::RGBA, tex->getSize(), false);
+	// Halley has no way to fence a readback and map it later, so the copy itself still waits for the GPU
+	auto img = std::make_shared<Image>(Image::Format::RGBA, tex->getSize(), false);
 	tex->copyToImage(*painter, *img); // NB: painter is null, so this is technically UB. DX11 textures don't actually use that field.
-	if (videoOut.isFlipped()) {
-		img->flipVertically();
-	}
-	for (auto& px: img->getPixels4BPP()) {
-		auto col = Image::convertIntToColour(px);
-		col.a = 255;
-		px = Image::convertColourToInt(col);
-	}
-	return img;
+
+	return Concurrent::execute(Executors::getCPU(), [img, flip = videoOut.isFlipped()] () -> std::shared_ptr<Image>
+	{
+		TraceScope trace("screenshot_convert");
+		if (flip) {
+			img->flipVertically();
+		}
+		const auto size = img->getSize();
+		const auto pixels = gsl::as_writable_bytes(img->getPixels4BPP());
+		PixelConvert::toRGBA8(PixelConvert::Format::XBGR8888, pixels, static_cast<size_t>(size.x) * 4, pixels, static_cast<size_t>(size.x) * 4, size);
+		return img;
+	});
 }
 
 const CoreConfig& LibretroCore::getCoreConfig() const
@@ -745,6 +1275,11 @@ bool LibretroCore::isScreenRotated() const
 	return systemAVInfo.rotation % 2 == 1;
 }
 
+bool LibretroCore::hasHardwareRendering() const
+{
+	return hwRenderCallback.has_value();
+}
+
 LibretroVFS& LibretroCore::getVFS()
 {
 	assert(!!vfs);
@@ -759,7 +1294,23 @@ void LibretroCore::loadVFS()
 void LibretroCore::setInputDevice(int idx, std::shared_ptr<InputVirtual> input)
 {
 	Expects(idx < maxInputDevices);
-	inputs[idx].device = std::move(input);
+	inputDevices[idx] = std::move(input);
+	inputMappingsDirty = true;
+}
+
+const LibretroCore::InputSnapshot& LibretroCore::getInputSnapshot() const
+{
+	return inputs;
+}
+
+void LibretroCore::setInputSnapshot(const InputSnapshot& snapshot)
+{
+	inputs = snapshot;
+}
+
+void LibretroCore::setExternalInput(bool enabled)
+{
+	externalInput = enabled;
 }
 
 void LibretroCore::setControllerType(int port, size_t idx)
@@ -771,6 +1322,12 @@ void LibretroCore::setControllerType(int port, size_t idx)
 		auto guard = ScopedGuard([=]() { popInstance(); });
 		pushInstance();
 		DLL_FUNC(dll, retro_set_controller_port_device)(port, controllerPort.types[idx].id);
+
+		if (secondInstance && static_cast<size_t>(port) < secondInstance->controllerTypes.size()) {
+			// Only touch it while it's idle
+			runAheadWorker->wait();
+			secondInstance->setControllerType(port, idx);
+		}
 	}
 }
 
@@ -792,6 +1349,11 @@ void LibretroCore::setOption(const String& key, const String& value)
 		if (std_ex::contains_if(option.values, [&] (const Option::Value& v) { return v.value == value; })) {
 			option.value = value;
 			optionsModified = true;
+
+			if (secondInstance) {
+				runAheadWorker->wait();
+				secondInstance->setOption(key, value);
+			}
 		} else {
 			Logger::logError("Unknown value \"" + value + "\" for option \"" + key + "\"");
 		}
@@ -809,6 +1371,103 @@ const Vector<LibretroCore::PortControllerTypes> LibretroCore::getControllerTypes
 	return controllerTypes;
 }
 
+bool LibretroCore::startMovieRecording()
+{
+	stopMoviePlayback();
+
+	auto state = saveState(SaveStateType::Normal);
+	if (state.empty()) {
+		Logger::logError("Failed to save state to start recording input movie.");
+		return false;
+	}
+
+	movieRecording = std::make_shared<InputMovie>();
+	movieRecording->setStartState(std::move(state));
+	movieRecording->setCoreId(coreConfig.getId());
+	movieRecording->setGameName(gameName);
+	movieRecordingStopped = false;
+	++movieRecordingId;
+	return true;
+}
+
+std::shared_ptr<InputMovie> LibretroCore::stopMovieRecording()
+{
+	movieRecordingStopped = false;
+	return std::move(movieRecording);
+}
+
+bool LibretroCore::isRecordingMovie() const
+{
+	return movieRecording && !movieRecordingStopped;
+}
+
+uint64_t LibretroCore::getMoviePosition() const
+{
+	if (!isRecordingMovie()) {
+		return 0;
+	}
+	return (static_cast<uint64_t>(movieRecordingId) << 32) | static_cast<uint64_t>(movieRecording->getFrameCount());
+}
+
+bool LibretroCore::loadRewindState(const Bytes& bytes, uint64_t moviePosition)
+{
+	stopMoviePlayback();
+	if (!unserializeState(SaveStateType::Normal, gsl::as_bytes(gsl::span<const Byte>(bytes)))) {
+		return false;
+	}
+
+	if (isRecordingMovie()) {
+		const auto recordingId = static_cast<uint32_t>(moviePosition >> 32);
+		const auto frame = static_cast<size_t>(moviePosition & 0xFFFFFFFF);
+		if (recordingId == movieRecordingId && frame <= movieRecording->getFrameCount()) {
+			movieRecording->truncate(frame);
+		} else {
+			Logger::logWarning("Rewound to before the input movie started recording, the recording ends here.");
+			movieRecordingStopped = true;
+		}
+	}
+	return true;
+}
+
+bool LibretroCore::startMoviePlayback(std::shared_ptr<InputMovie> movie)
+{
+	stopMoviePlayback();
+	if (!movie) {
+		return false;
+	}
+
+	if (movie->getCoreId() != coreConfig.getId()) {
+		Logger::logWarning("Input movie was recorded on core " + movie->getCoreId() + ", it will likely desync on " + coreConfig.getId() + ".");
+	}
+	if (!unserializeState(SaveStateType::Normal, gsl::as_bytes(gsl::span<const Byte>(movie->getStartState())))) {
+		Logger::logError("Failed to load input movie start state.");
+		return false;
+	}
+	if (isRecordingMovie()) {
+		Logger::logWarning("Started playing back an input movie while recording one, the recording ends here.");
+		movieRecordingStopped = true;
+	}
+
+	movie->resetPlayback();
+	moviePlayback = std::move(movie);
+	return true;
+}
+
+void LibretroCore::stopMoviePlayback()
+{
+	if (moviePlayback) {
+		if (moviePlayback->hasDesynced()) {
+			Logger::logWarning("Input movie desynced, the core didn't read the same inputs it did when recording.");
+		}
+		moviePlayback.reset();
+	}
+}
+
+bool LibretroCore::isPlayingMovie() const
+{
+	return static_cast<bool>(moviePlayback);
+}
+
 bool LibretroCore::onEnvironment(uint32_t cmd, void* data)
 {
 	switch (cmd) {
@@ -888,9 +1547,7 @@ bool LibretroCore::onEnvironment(uint32_t cmd, void* data)
 		return false;
 
 	case RETRO_ENVIRONMENT_SET_AUDIO_CALLBACK:
-		// TODO
-		Logger::logWarning("TODO: RETRO_ENVIRONMENT_SET_AUDIO_CALLBACK");
-		return false;
+		return onEnvSetAudioCallback(static_cast<const retro_audio_callback*>(data));
 
 	case RETRO_ENVIRONMENT_GET_RUMBLE_INTERFACE:
 		onEnvGetRumbleInterface(*static_cast<retro_rumble_interface*>(data));
@@ -969,9 +1626,7 @@ bool LibretroCore::onEnvironment(uint32_t cmd, void* data)
 		return true;
 
 	case RETRO_ENVIRONMENT_GET_CURRENT_SOFTWARE_FRAMEBUFFER:
-		// TODO
-		Logger::logWarning("TODO: RETRO_ENVIRONMENT_GET_CURRENT_SOFTWARE_FRAMEBUFFER");
-		return false;
+		return onEnvGetCurrentSoftwareFramebuffer(*static_cast<retro_framebuffer*>(data));
 
 	case RETRO_ENVIRONMENT_GET_HW_RENDER_INTERFACE:
 		return onEnvGetHWRenderInterface(static_cast<const retro_hw_render_interface**>(data));
@@ -1011,7 +1666,7 @@ bool LibretroCore::onEnvironment(uint32_t cmd, void* data)
 		return false;
 
 	case RETRO_ENVIRONMENT_GET_FASTFORWARDING:
-		*static_cast<bool*>(data) = false;
+		*static_cast<bool*>(data) = fastForwardActive;
 		return true;
 
 	case RETRO_ENVIRONMENT_GET_TARGET_REFRESH_RATE:
@@ -1072,9 +1727,7 @@ bool LibretroCore::onEnvironment(uint32_t cmd, void* data)
 		return true;
 
 	case RETRO_ENVIRONMENT_SET_FASTFORWARDING_OVERRIDE:
-		// TODO
-		Logger::logWarning("TODO: RETRO_ENVIRONMENT_SET_FASTFORWARDING_OVERRIDE");
-		return false;
+		return onEnvSetFastForwardingOverride(static_cast<const retro_fastforwarding_override*>(data));
 
 	case RETRO_ENVIRONMENT_SET_CONTENT_INFO_OVERRIDE:
 		if (data) {
@@ -1105,9 +1758,10 @@ bool LibretroCore::onEnvironment(uint32_t cmd, void* data)
 		return false;
 
 	case RETRO_ENVIRONMENT_GET_THROTTLE_STATE:
-		// TODO
-		Logger::logWarning("TODO: RETRO_ENVIRONMENT_GET_THROTTLE_STATE");
-		return false;
+		if (data) {
+			onEnvGetThrottleState(*static_cast<retro_throttle_state*>(data));
+		}
+		return true;
 
 	case RETRO_ENVIRONMENT_GET_SAVESTATE_CONTEXT:
 		if (data) {
@@ -1127,15 +1781,40 @@ bool LibretroCore::onEnvironment(uint32_t cmd, void* data)
 
 void LibretroCore::onVideoRefresh(const void* data, uint32_t width, uint32_t height, size_t pitch)
 {
+	const auto startTime = FrameTrace::now();
+	auto timer = ScopedGuard([&] () { addCallbackTime(startTime); });
+
 	if (pitch == 0) {
 		pitch = width;
 	}
 
 	const auto size = Vector2i(static_cast<int>(width), static_cast<int>(height));
-	if (size.x == 0 || size.y == 0) {
+	if (size.x == 0 || size.y == 0 || !videoEnabled) {
 		return;
 	}
 
+	if (thumbnailMaxWidth > 0 && data != nullptr && data != RETRO_HW_FRAME_BUFFER_VALID) {
+		captureThumbnail(data, size, pitch);
+	}
+
+	if (videoCapture) {
+		captureVideoFrame(data, size, pitch);
+		return;
+	}
+
+	if (!cpuUpdateTexture) {
+		// Headless
+		return;
+	}
+
+	uploadVideoFrame(data, size, pitch);
+}
+
+void LibretroCore::uploadVideoFrame(const void* data, Vector2i size, size_t pitch)
+{
+	TraceScope trace("video_upload");
+	const auto height = static_cast<size_t>(size.y);
+
 	std::shared_ptr<Texture> tex;
 	bool flipBuffer = false;
 	if (data == nullptr) {
@@ -1152,8 +1831,7 @@ void LibretroCore::onVideoRefresh(const void* data, uint32_t width, uint32_t hei
 		lastFrameIsCPU = false;
 	} else {
 		// Software buffer
-		const auto dataSpan = gsl::span<const char>(static_cast<const char*>(data), pitch * height);
-		cpuUpdateTexture->update(size, static_cast<int>(pitch), gsl::as_bytes(dataSpan), getTextureFormat(systemAVInfo.pixelFormat));
+		uploadSoftwareFrame(data, size, pitch);
 		tex = cpuUpdateTexture->getTexture();
 		lastFrameIsCPU = true;
 	}
@@ -1162,7 +1840,7 @@ void LibretroCore::onVideoRefresh(const void* data, uint32_t width, uint32_t hei
 	if (!tex && !videoOut.getMaterial().getTexture(0)) {
 		Vector<char> temp;
 		temp.resize(pitch * height, 0);
-		cpuUpdateTexture->update(size, static_cast<int>(pitch), temp.byte_span(), getTextureFormat(systemAVInfo.pixelFormat));
+		uploadSoftwareFrame(temp.data(), size, pitch);
 		tex = cpuUpdateTexture->getTexture();
 	}
 
@@ -1181,36 +1859,131 @@ void LibretroCore::onVideoRefresh(const void* data, uint32_t width, uint32_t hei
 		.setRotation(Angle1f::fromDegrees(360.0f - systemAVInfo.rotation * 90.0f + (flipBuffer ? 180.0f : 0.0f)));
 }
 
+void LibretroCore::uploadSoftwareFrame(const void* data, Vector2i size, size_t pitch)
+{
+	const auto src = gsl::as_bytes(gsl::span<const char>(static_cast<const char*>(data), pitch * size.y));
+
+	if (convertPixelFormat) {
+		// Convert straight into the upload staging memory
+		const size_t dstPitch = size.x * 4;
+		const auto staging = cpuUpdateTexture->getNextStagingBuffer(dstPitch * size.y);
+		PixelConvert::toRGBA8(getPixelConvertFormat(systemAVInfo.pixelFormat), src, pitch, staging, dstPitch, size);
+		cpuUpdateTexture->update(size, static_cast<int>(dstPitch), staging, TextureFormat::RGBA);
+	} else {
+		cpuUpdateTexture->update(size, static_cast<int>(pitch), src, getTextureFormat(systemAVInfo.pixelFormat));
+	}
+}
+
+void LibretroCore::setVideoCapture(VideoFrame* target)
+{
+	videoCapture = target;
+}
+
+void LibretroCore::captureVideoFrame(const void* data, Vector2i size, size_t pitch)
+{
+	auto& frame = *videoCapture;
+	frame.size = size;
+	frame.pitch = static_cast<int>(pitch);
+
+	if (data == nullptr || data == RETRO_HW_FRAME_BUFFER_VALID) {
+		frame.dupe = true;
+	} else {
+		frame.dupe = false;
+		if (data != frame.data.data()) {
+			frame.data.resize(pitch * size.y);
+			memcpy(frame.data.data(), data, frame.data.size());
+		}
+	}
+}
+
+void LibretroCore::captureThumbnail(const void* data, Vector2i size, size_t pitch)
+{
+	// Point sampled, converting only the rows that are actually used
+	const int step = std::max(1, (size.x + thumbnailMaxWidth - 1) / thumbnailMaxWidth);
+	const auto thumbSize = Vector2i(std::max(1, size.x / step), std::max(1, size.y / step));
+	const auto format = getPixelConvertFormat(systemAVInfo.pixelFormat);
+
+	Vector<uint32_t> row(static_cast<size_t>(size.x));
+	const auto rowBytes = gsl::as_writable_bytes(gsl::span<uint32_t>(row));
+	thumbnail = std::make_unique<Image>(Image::Format::RGBA, thumbSize, false);
+	auto dst = thumbnail->getPixels4BPP();
+	for (int y = 0; y < thumbSize.y; ++y) {
+		const auto src = gsl::as_bytes(gsl::span<const char>(static_cast<const char*>(data) + static_cast<size_t>(y * step) * pitch, pitch));
+		PixelConvert::toRGBA8(format, src, pitch, rowBytes, rowBytes.size(), Vector2i(size.x, 1));
+		for (int x = 0; x < thumbSize.x; ++x) {
+			dst[y * thumbSize.x + x] = static_cast<int>(row[x * step]);
+		}
+	}
+
+	thumbnailMaxWidth = 0;
+}
+
+void LibretroCore::requestThumbnail(int maxWidth)
+{
+	thumbnailMaxWidth = maxWidth;
+}
+
+std::unique_ptr<Image> LibretroCore::takeThumbnail()
+{
+	return std::move(thumbnail);
+}
+
+void LibretroCore::presentVideoFrame(const VideoFrame& frame)
+{
+	if (frame.size.x > 0 && frame.size.y > 0) {
+		// Bypasses capture, as this may run on a different thread than the one capturing frames
+		uploadVideoFrame(frame.dupe ? nullptr : frame.data.data(), frame.size, frame.pitch);
+	}
+}
+
 void LibretroCore::onAudioSample(int16_t left, int16_t right)
 {
-	if (!rewinding) {
-		audioBuffer.push_back(left / 32768.0f);
-		audioBuffer.push_back(right / 32768.0f);
-		if (audioBuffer.size() >= 256) {
-			addAudioSamples(gsl::span<const float>(audioBuffer.data(), audioBuffer.size()));
-			audioBuffer.clear();
+	if (!rewinding && audioEnabled && !fastForwardActive) {
+		auto lock = lockAudio();
+		audioSampleBuffer[audioSampleCount++] = left / 32768.0f;
+		audioSampleBuffer[audioSampleCount++] = right / 32768.0f;
+		if (audioSampleCount == audioSampleBuffer.size()) {
+			addAudioSamples(gsl::span<const float>(audioSampleBuffer.data(), audioSampleCount));
+			audioSampleCount = 0;
 		}
 	}
 }
 
 size_t LibretroCore::onAudioSampleBatch(const int16_t* data, size_t frames)
 {
-	const size_t samples = frames * 2;
-
-	if (audioBuffer.size() < samples) {
-		audioBuffer.resize(nextPowerOf2(samples));
+	if (!audioEnabled || fastForwardActive) {
+		// Audio is skipped while fast-forwarding, as it can't be played back at that rate anyway
+		return frames;
 	}
 
-	for (size_t i = 0; i < samples; ++i) {
-		audioBuffer[i] = data[i] / 32768.0f;
+	const auto startTime = FrameTrace::now();
+	auto timer = ScopedGuard([&] () { addCallbackTime(startTime); });
+
+	auto lock = lockAudio();
+
+	// Keep any single samples in order with this batch
+	if (audioSampleCount > 0) {
+		addAudioSamples(gsl::span<const float>(audioSampleBuffer.data(), audioSampleCount));
+		audioSampleCount = 0;
 	}
 
-	if (rewinding) {
-		std::reverse(audioBuffer.begin(), audioBuffer.begin() + samples);
+	// Convert in chunks that fit the preallocated buffer
+	const auto chunkFrames = audioConvertBuffer.size() / 2;
+	for (size_t start = 0; start < frames; start += chunkFrames) {
+		// When rewinding, the batch is played backwards, so chunks go in reverse order too
+		const size_t n = std::min(chunkFrames, frames - start);
+		const size_t offset = rewinding ? frames - start - n : start;
+		const auto src = gsl::span<const int16_t>(data + offset * 2, n * 2);
+		const auto dst = gsl::span<float>(audioConvertBuffer.data(), n * 2);
+		AudioConvert::int16ToFloat(src, dst);
+
+		if (rewinding) {
+			std::reverse(dst.begin(), dst.end());
+		}
+
+		addAudioSamples(dst);
 	}
 
-	addAudioSamples(gsl::span<const float>(audioBuffer.data(), samples));
-	
 	return frames;
 }
 
@@ -1221,6 +1994,7 @@ void LibretroCore::onEnvSetInputDescriptors(const retro_input_descriptor* data)
 		if (isStick) {
 			hasAnalogStick = true;
 		}
+		markInputDeviceUsed(descriptor->port, descriptor->device);
 
 		// TODO: store this?
 		const char* devNames[] = { "RETRO_DEVICE_NONE", "RETRO_DEVICE_JOYPAD", "RETRO_DEVICE_MOUSE", "RETRO_DEVICE_KEYBOARD", "RETRO_DEVICE_LIGHTGUN", "RETRO_DEVICE_ANALOG", "RETRO_DEVICE_POINTER" };
@@ -1230,6 +2004,34 @@ void LibretroCore::onEnvSetInputDescriptors(const retro_input_descriptor* data)
 	}
 }
 
+bool LibretroCore::onEnvSetFastForwardingOverride(const retro_fastforwarding_override* data)
+{
+	if (data) {
+		std::unique_lock<std::mutex> lock(fastForwardOverrideMutex);
+		fastForwardOverride = *data;
+	}
+	return true;
+}
+
+void LibretroCore::onEnvGetThrottleState(retro_throttle_state& data)
+{
+	const auto fps = static_cast<float>(systemAVInfo.fps);
+	if (paused) {
+		data.mode = RETRO_THROTTLE_FRAME_STEPPING;
+		data.rate = 0;
+	} else if (rewinding) {
+		data.mode = RETRO_THROTTLE_REWINDING;
+		data.rate = fps;
+	} else if (fastForwardActive) {
+		const float speed = fastForwardSpeed;
+		data.mode = RETRO_THROTTLE_FAST_FORWARD;
+		data.rate = speed >= 1.0f ? fps * speed : 0.0f;
+	} else {
+		data.mode = RETRO_THROTTLE_NONE;
+		data.rate = fps;
+	}
+}
+
 void LibretroCore::onEnvSetControllerInfo(const retro_controller_info* data)
 {
 	controllerTypes.clear();
@@ -1263,92 +2065,236 @@ void LibretroCore::onEnvGetRumbleInterface(retro_rumble_interface& data)
 
 void LibretroCore::onInputPoll()
 {
+	if (externalInput) {
+		// Input state is provided via setInputSnapshot()
+		return;
+	}
+	if (moviePlayback && !runningHiddenFrame) {
+		// Input state comes from the movie
+		return;
+	}
+
+	TraceScope trace("input_poll");
+	const auto startTime = FrameTrace::now();
+	pollInputDevices(inputs);
+
+	// Input age runs from when the engine received the OS events this poll reads, to the poll handing them to the core
+	const auto endTime = FrameTrace::now();
+	if (const auto sampleTime = environment.getInputEventsTime(); sampleTime != 0) {
+		const Time age = static_cast<Time>(endTime - sampleTime) / 1'000'000'000.0;
+		inputLatencyStats.polls++;
+		inputLatencyStats.totalAge += age;
+		inputLatencyStats.maxAge = std::max(inputLatencyStats.maxAge, age);
+	}
+	addCallbackTime(startTime);
+}
+
+namespace {
+	enum InputMaskTarget : uint8_t {
+		INPUT_MASK_JOYPAD,
+		INPUT_MASK_MOUSE,
+		INPUT_MASK_LIGHTGUN,
+		INPUT_MASK_COUNT
+	};
+
+	struct InputButtonSource {
+		LibretroButtons::Buttons button;
+		InputMaskTarget target;
+		uint8_t bit;
+	};
+
+	constexpr InputButtonSource inputButtonSources[] = {
+		{ LibretroButtons::LIBRETRO_BUTTON_UP, INPUT_MASK_JOYPAD, RETRO_DEVICE_ID_JOYPAD_UP },
+		{ LibretroButtons::LIBRETRO_BUTTON_DOWN, INPUT_MASK_JOYPAD, RETRO_DEVICE_ID_JOYPAD_DOWN },
+		{ LibretroButtons::LIBRETRO_BUTTON_LEFT, INPUT_MASK_JOYPAD, RETRO_DEVICE_ID_JOYPAD_LEFT },
+		{ LibretroButtons::LIBRETRO_BUTTON_RIGHT, INPUT_MASK_JOYPAD, RETRO_DEVICE_ID_JOYPAD_RIGHT },
+		{ LibretroButtons::LIBRETRO_BUTTON_A, INPUT_MASK_JOYPAD, RETRO_DEVICE_ID_JOYPAD_A },
+		{ LibretroButtons::LIBRETRO_BUTTON_B, INPUT_MASK_JOYPAD, RETRO_DEVICE_ID_JOYPAD_B },
+		{ LibretroButtons::LIBRETRO_BUTTON_X, INPUT_MASK_JOYPAD, RETRO_DEVICE_ID_JOYPAD_X },
+		{ LibretroButtons::LIBRETRO_BUTTON_Y, INPUT_MASK_JOYPAD, RETRO_DEVICE_ID_JOYPAD_Y },
+		{ LibretroButtons::LIBRETRO_BUTTON_SELECT, INPUT_MASK_JOYPAD, RETRO_DEVICE_ID_JOYPAD_SELECT },
+		{ LibretroButtons::LIBRETRO_BUTTON_START, INPUT_MASK_JOYPAD, RETRO_DEVICE_ID_JOYPAD_START },
+		{ LibretroButtons::LIBRETRO_BUTTON_L, INPUT_MASK_JOYPAD, RETRO_DEVICE_ID_JOYPAD_L },
+		{ LibretroButtons::LIBRETRO_BUTTON_R, INPUT_MASK_JOYPAD, RETRO_DEVICE_ID_JOYPAD_R },
+		{ LibretroButtons::LIBRETRO_BUTTON_L2, INPUT_MASK_JOYPAD, RETRO_DEVICE_ID_JOYPAD_L2 },
+		{ LibretroButtons::LIBRETRO_BUTTON_R2, INPUT_MASK_JOYPAD, RETRO_DEVICE_ID_JOYPAD_R2 },
+		{ LibretroButtons::LIBRETRO_BUTTON_L3, INPUT_MASK_JOYPAD, RETRO_DEVICE_ID_JOYPAD_L3 },
+		{ LibretroButtons::LIBRETRO_BUTTON_R3, INPUT_MASK_JOYPAD, RETRO_DEVICE_ID_JOYPAD_R3 },
+
+		{ LibretroButtons::LIBRETRO_BUTTON_MOUSE_LEFT, INPUT_MASK_MOUSE, RETRO_DEVICE_ID_MOUSE_LEFT },
+		{ LibretroButtons::LIBRETRO_BUTTON_MOUSE_RIGHT, INPUT_MASK_MOUSE, RETRO_DEVICE_ID_MOUSE_RIGHT },
+		{ LibretroButtons::LIBRETRO_BUTTON_MOUSE_MIDDLE, INPUT_MASK_MOUSE, RETRO_DEVICE_ID_MOUSE_MIDDLE },
+		{ LibretroButtons::LIBRETRO_BUTTON_MOUSE_4, INPUT_MASK_MOUSE, RETRO_DEVICE_ID_MOUSE_BUTTON_4 },
+		{ LibretroButtons::LIBRETRO_BUTTON_MOUSE_5, INPUT_MASK_MOUSE, RETRO_DEVICE_ID_MOUSE_BUTTON_5 },
+		{ LibretroButtons::LIBRETRO_BUTTON_MOUSE_WHEEL_UP, INPUT_MASK_MOUSE, RETRO_DEVICE_ID_MOUSE_WHEELUP },
+		{ LibretroButtons::LIBRETRO_BUTTON_MOUSE_WHEEL_DOWN, INPUT_MASK_MOUSE, RETRO_DEVICE_ID_MOUSE_WHEELDOWN },
+		{ LibretroButtons::LIBRETRO_BUTTON_MOUSE_WHEEL_LEFT, INPUT_MASK_MOUSE, RETRO_DEVICE_ID_MOUSE_HORIZ_WHEELDOWN },
+		{ LibretroButtons::LIBRETRO_BUTTON_MOUSE_WHEEL_RIGHT, INPUT_MASK_MOUSE, RETRO_DEVICE_ID_MOUSE_HORIZ_WHEELUP },
+
+		{ LibretroButtons::LIBRETRO_BUTTON_LIGHTGUN_TRIGGER, INPUT_MASK_LIGHTGUN, RETRO_DEVICE_ID_LIGHTGUN_TRIGGER },
+		{ LibretroButtons::LIBRETRO_BUTTON_LIGHTGUN_A, INPUT_MASK_LIGHTGUN, RETRO_DEVICE_ID_LIGHTGUN_AUX_A },
+		{ LibretroButtons::LIBRETRO_BUTTON_LIGHTGUN_B, INPUT_MASK_LIGHTGUN, RETRO_DEVICE_ID_LIGHTGUN_AUX_B },
+		{ LibretroButtons::LIBRETRO_BUTTON_LIGHTGUN_C, INPUT_MASK_LIGHTGUN, RETRO_DEVICE_ID_LIGHTGUN_AUX_C },
+		{ LibretroButtons::LIBRETRO_BUTTON_LIGHTGUN_START, INPUT_MASK_LIGHTGUN, RETRO_DEVICE_ID_LIGHTGUN_START },
+		{ LibretroButtons::LIBRETRO_BUTTON_LIGHTGUN_SELECT, INPUT_MASK_LIGHTGUN, RETRO_DEVICE_ID_LIGHTGUN_SELECT },
+		{ LibretroButtons::LIBRETRO_BUTTON_LIGHTGUN_IS_OFFSCREEN, INPUT_MASK_LIGHTGUN, RETRO_DEVICE_ID_LIGHTGUN_IS_OFFSCREEN },
+		{ LibretroButtons::LIBRETRO_BUTTON_LIGHTGUN_RELOAD, INPUT_MASK_LIGHTGUN, RETRO_DEVICE_ID_LIGHTGUN_RELOAD },
+		{ LibretroButtons::LIBRETRO_BUTTON_LIGHTGUN_DPAD_UP, INPUT_MASK_LIGHTGUN, RETRO_DEVICE_ID_LIGHTGUN_DPAD_UP },
+		{ LibretroButtons::LIBRETRO_BUTTON_LIGHTGUN_DPAD_DOWN, INPUT_MASK_LIGHTGUN, RETRO_DEVICE_ID_LIGHTGUN_DPAD_DOWN },
+		{ LibretroButtons::LIBRETRO_BUTTON_LIGHTGUN_DPAD_LEFT, INPUT_MASK_LIGHTGUN, RETRO_DEVICE_ID_LIGHTGUN_DPAD_LEFT },
+		{ LibretroButtons::LIBRETRO_BUTTON_LIGHTGUN_DPAD_RIGHT, INPUT_MASK_LIGHTGUN, RETRO_DEVICE_ID_LIGHTGUN_DPAD_RIGHT },
+	};
+
+	constexpr uint32_t inputDeviceBit(uint32_t device)
+	{
+		return 1u << (device & RETRO_DEVICE_MASK);
+	}
+}
+
+void LibretroCore::markInputDeviceUsed(uint32_t port, uint32_t device)
+{
+	if (port >= maxInputDevices) {
+		return;
+	}
+
+	const auto bit = inputDeviceBit(device);
+	if ((inputDeviceUsage[port].load(std::memory_order_relaxed) & bit) == 0) {
+		inputDeviceUsage[port].fetch_or(bit);
+		inputMappingsDirty = true;
+	}
+}
+
+void LibretroCore::updateInputMappings()
+{
+	// Until the core has read some input, we don't know what it uses, so poll everything
+	const bool known = inputDeviceUsageKnown;
+
 	for (int i = 0; i < maxInputDevices; ++i) {
-		inputs[i].buttonMask = 0;
-		if (const auto& input = inputs[i].device; input) {
-			input->update(0); // TODO: pass correct time?
-			
-			uint16_t value = 0;
-			uint16_t mouseValue = 0;
-			uint16_t lightGunValue = 0;
-
-			value |= input->isButtonDown(LibretroButtons::Buttons::LIBRETRO_BUTTON_UP) ? (1 << RETRO_DEVICE_ID_JOYPAD_UP) : 0;
-			value |= input->isButtonDown(LibretroButtons::Buttons::LIBRETRO_BUTTON_DOWN) ? (1 << RETRO_DEVICE_ID_JOYPAD_DOWN) : 0;
-			value |= input->isButtonDown(LibretroButtons::Buttons::LIBRETRO_BUTTON_LEFT) ? (1 << RETRO_DEVICE_ID_JOYPAD_LEFT) : 0;
-			value |= input->isButtonDown(LibretroButtons::Buttons::LIBRETRO_BUTTON_RIGHT) ? (1 << RETRO_DEVICE_ID_JOYPAD_RIGHT) : 0;
-
-			value |= input->isButtonDown(LibretroButtons::Buttons::LIBRETRO_BUTTON_A) ? (1 << RETRO_DEVICE_ID_JOYPAD_A) : 0;
-			value |= input->isButtonDown(LibretroButtons::Buttons::LIBRETRO_BUTTON_B) ? (1 << RETRO_DEVICE_ID_JOYPAD_B) : 0;
-			value |= input->isButtonDown(LibretroButtons::Buttons::LIBRETRO_BUTTON_X) ? (1 << RETRO_DEVICE_ID_JOYPAD_X) : 0;
-			value |= input->isButtonDown(LibretroButtons::Buttons::LIBRETRO_BUTTON_Y) ? (1 << RETRO_DEVICE_ID_JOYPAD_Y) : 0;
-
-			value |= input->isButtonDown(LibretroButtons::Buttons::LIBRETRO_BUTTON_SELECT) ? (1 << RETRO_DEVICE_ID_JOYPAD_SELECT) : 0;
-			value |= input->isButtonDown(LibretroButtons::Buttons::LIBRETRO_BUTTON_START) ? (1 << RETRO_DEVICE_ID_JOYPAD_START) : 0;
-			
-			value |= input->isButtonDown(LibretroButtons::Buttons::LIBRETRO_BUTTON_L) ? (1 << RETRO_DEVICE_ID_JOYPAD_L) : 0;
-			value |= input->isButtonDown(LibretroButtons::Buttons::LIBRETRO_BUTTON_R) ? (1 << RETRO_DEVICE_ID_JOYPAD_R) : 0;
-			value |= input->isButtonDown(LibretroButtons::Buttons::LIBRETRO_BUTTON_L2) ? (1 << RETRO_DEVICE_ID_JOYPAD_L2) : 0;
-			value |= input->isButtonDown(LibretroButtons::Buttons::LIBRETRO_BUTTON_R2) ? (1 << RETRO_DEVICE_ID_JOYPAD_R2) : 0;
-			value |= input->isButtonDown(LibretroButtons::Buttons::LIBRETRO_BUTTON_L3) ? (1 << RETRO_DEVICE_ID_JOYPAD_L3) : 0;
-			value |= input->isButtonDown(LibretroButtons::Buttons::LIBRETRO_BUTTON_R3) ? (1 << RETRO_DEVICE_ID_JOYPAD_R3) : 0;
-
-			mouseValue |= input->isButtonDown(LibretroButtons::Buttons::LIBRETRO_BUTTON_MOUSE_LEFT) ? (1 << RETRO_DEVICE_ID_MOUSE_LEFT) : 0;
-			mouseValue |= input->isButtonDown(LibretroButtons::Buttons::LIBRETRO_BUTTON_MOUSE_RIGHT) ? (1 << RETRO_DEVICE_ID_MOUSE_RIGHT) : 0;
-			mouseValue |= input->isButtonDown(LibretroButtons::Buttons::LIBRETRO_BUTTON_MOUSE_MIDDLE) ? (1 << RETRO_DEVICE_ID_MOUSE_MIDDLE) : 0;
-			mouseValue |= input->isButtonDown(LibretroButtons::Buttons::LIBRETRO_BUTTON_MOUSE_4) ? (1 << RETRO_DEVICE_ID_MOUSE_BUTTON_4) : 0;
-			mouseValue |= input->isButtonDown(LibretroButtons::Buttons::LIBRETRO_BUTTON_MOUSE_5) ? (1 << RETRO_DEVICE_ID_MOUSE_BUTTON_5) : 0;
-			mouseValue |= input->isButtonDown(LibretroButtons::Buttons::LIBRETRO_BUTTON_MOUSE_WHEEL_UP) ? (1 << RETRO_DEVICE_ID_MOUSE_WHEELUP) : 0;
-			mouseValue |= input->isButtonDown(LibretroButtons::Buttons::LIBRETRO_BUTTON_MOUSE_WHEEL_DOWN) ? (1 << RETRO_DEVICE_ID_MOUSE_WHEELDOWN) : 0;
-			mouseValue |= input->isButtonDown(LibretroButtons::Buttons::LIBRETRO_BUTTON_MOUSE_WHEEL_LEFT) ? (1 << RETRO_DEVICE_ID_MOUSE_HORIZ_WHEELDOWN) : 0;
-			mouseValue |= input->isButtonDown(LibretroButtons::Buttons::LIBRETRO_BUTTON_MOUSE_WHEEL_RIGHT) ? (1 << RETRO_DEVICE_ID_MOUSE_HORIZ_WHEELUP) : 0;
-
-			lightGunValue |= input->isButtonDown(LibretroButtons::Buttons::LIBRETRO_BUTTON_LIGHTGUN_TRIGGER) ? (1 << RETRO_DEVICE_ID_LIGHTGUN_TRIGGER) : 0;
-			lightGunValue |= input->isButtonDown(LibretroButtons::Buttons::LIBRETRO_BUTTON_LIGHTGUN_A) ? (1 << RETRO_DEVICE_ID_LIGHTGUN_AUX_A) : 0;
-			lightGunValue |= input->isButtonDown(LibretroButtons::Buttons::LIBRETRO_BUTTON_LIGHTGUN_B) ? (1 << RETRO_DEVICE_ID_LIGHTGUN_AUX_B) : 0;
-			lightGunValue |= input->isButtonDown(LibretroButtons::Buttons::LIBRETRO_BUTTON_LIGHTGUN_C) ? (1 << RETRO_DEVICE_ID_LIGHTGUN_AUX_C) : 0;
-			lightGunValue |= input->isButtonDown(LibretroButtons::Buttons::LIBRETRO_BUTTON_LIGHTGUN_START) ? (1 << RETRO_DEVICE_ID_LIGHTGUN_START) : 0;
-			lightGunValue |= input->isButtonDown(LibretroButtons::Buttons::LIBRETRO_BUTTON_LIGHTGUN_SELECT) ? (1 << RETRO_DEVICE_ID_LIGHTGUN_SELECT) : 0;
-			lightGunValue |= input->isButtonDown(LibretroButtons::Buttons::LIBRETRO_BUTTON_LIGHTGUN_IS_OFFSCREEN) ? (1 << RETRO_DEVICE_ID_LIGHTGUN_IS_OFFSCREEN) : 0;
-			lightGunValue |= input->isButtonDown(LibretroButtons::Buttons::LIBRETRO_BUTTON_LIGHTGUN_RELOAD) ? (1 << RETRO_DEVICE_ID_LIGHTGUN_RELOAD) : 0;
-			lightGunValue |= input->isButtonDown(LibretroButtons::Buttons::LIBRETRO_BUTTON_LIGHTGUN_DPAD_UP) ? (1 << RETRO_DEVICE_ID_LIGHTGUN_DPAD_UP) : 0;
-			lightGunValue |= input->isButtonDown(LibretroButtons::Buttons::LIBRETRO_BUTTON_LIGHTGUN_DPAD_DOWN) ? (1 << RETRO_DEVICE_ID_LIGHTGUN_DPAD_DOWN) : 0;
-			lightGunValue |= input->isButtonDown(LibretroButtons::Buttons::LIBRETRO_BUTTON_LIGHTGUN_DPAD_LEFT) ? (1 << RETRO_DEVICE_ID_LIGHTGUN_DPAD_LEFT) : 0;
-			lightGunValue |= input->isButtonDown(LibretroButtons::Buttons::LIBRETRO_BUTTON_LIGHTGUN_DPAD_RIGHT) ? (1 << RETRO_DEVICE_ID_LIGHTGUN_DPAD_RIGHT) : 0;
-
-			if (!hasAnalogStick) {
-				// Use left stick as d-pad if this core doesn't use analog sticks
-				const float threshold = 0.2f;
-				value |= input->getAxis(LibretroButtons::Axes::LIBRETRO_AXIS_LEFT_Y) < -threshold ? (1 << RETRO_DEVICE_ID_JOYPAD_UP) : 0;
-				value |= input->getAxis(LibretroButtons::Axes::LIBRETRO_AXIS_LEFT_Y) > threshold ? (1 << RETRO_DEVICE_ID_JOYPAD_DOWN) : 0;
-				value |= input->getAxis(LibretroButtons::Axes::LIBRETRO_AXIS_LEFT_X) < -threshold ? (1 << RETRO_DEVICE_ID_JOYPAD_LEFT) : 0;
-				value |= input->getAxis(LibretroButtons::Axes::LIBRETRO_AXIS_LEFT_X) > threshold ? (1 << RETRO_DEVICE_ID_JOYPAD_RIGHT) : 0;
+		const auto usage = known ? inputDeviceUsage[i].load() : ~0u;
+		const bool joypad = (usage & inputDeviceBit(RETRO_DEVICE_JOYPAD)) != 0;
+		const bool analog = (usage & inputDeviceBit(RETRO_DEVICE_ANALOG)) != 0;
+
+		auto& mapping = inputMappings[i];
+		mapping.buttons.clear();
+		for (const auto& source: inputButtonSources) {
+			const bool used = (source.target == INPUT_MASK_JOYPAD && (joypad || analog)) // Analog buttons are derived from the joypad mask
+				|| (source.target == INPUT_MASK_MOUSE && (usage & inputDeviceBit(RETRO_DEVICE_MOUSE)))
+				|| (source.target == INPUT_MASK_LIGHTGUN && (usage & inputDeviceBit(RETRO_DEVICE_LIGHTGUN)));
+			if (used) {
+				mapping.buttons.push_back(InputButtonMapping{ static_cast<int>(source.button), static_cast<uint8_t>(source.target), source.bit });
 			}
+		}
+		mapping.dpadFromStick = (joypad || analog) && !hasAnalogStick;
+		mapping.analog = analog;
+		mapping.mouse = (usage & inputDeviceBit(RETRO_DEVICE_MOUSE)) != 0;
+		mapping.lightGun = (usage & inputDeviceBit(RETRO_DEVICE_LIGHTGUN)) != 0;
+		mapping.active = usage != 0;
+	}
+
+	inputMappingsDirty = false;
+}
+
+const LibretroCore::InputLatencyStats& LibretroCore::getInputLatencyStats() const
+{
+	return inputLatencyStats;
+}
+
+void LibretroCore::resetInputLatencyStats()
+{
+	inputLatencyStats = {};
+}
 
+String LibretroCore::InputLatencyStats::toString() const
+{
+	const auto avg = polls > 0 ? totalAge / static_cast<Time>(polls) : 0.0;
+	return Halley::toString(polls) + " polls, input age avg " + Halley::toString(avg * 1000.0, 2) + " ms, max " + Halley::toString(maxAge * 1000.0, 2) + " ms";
+}
+
+void LibretroCore::pollInputDevices(InputSnapshot& dst)
+{
+	if (inputMappingsDirty) {
+		updateInputMappings();
+	}
+
+	// Late latching snapshots the devices the engine has already pumped, advancing virtual inputs by the real time between polls,
+	// so hold/repeat timings stay correct with several polls per frame. OS events are never pumped from here, as this runs inside retro_run.
+	Time dt = 0;
+	if (coreConfig.hasLateInputLatch()) {
+		const auto now = FrameTrace::now();
+		dt = lastInputUpdateTime != 0 ? static_cast<Time>(now - lastInputUpdateTime) / 1'000'000'000.0 : 0.0;
+		lastInputUpdateTime = now;
+	}
+
+	for (int i = 0; i < maxInputDevices; ++i) {
+		// Start every port from scratch, so nothing lingers from a device that has since been unplugged or unmapped
+		dst[i] = InputState();
+		const auto& input = inputDevices[i];
+		const auto& mapping = inputMappings[i];
+		if (!input || !mapping.active) {
+			continue;
+		}
+
+		input->update(dt);
+
+		std::array<uint16_t, INPUT_MASK_COUNT> masks = {};
+		for (const auto& button: mapping.buttons) {
+			masks[button.target] |= static_cast<uint16_t>(input->isButtonDown(button.button) ? 1 : 0) << button.bit;
+		}
+
+		if (mapping.dpadFromStick) {
+			// Use left stick as d-pad if this core doesn't use analog sticks
+			const float threshold = 0.2f;
+			const auto x = input->getAxis(LibretroButtons::Axes::LIBRETRO_AXIS_LEFT_X);
+			const auto y = input->getAxis(LibretroButtons::Axes::LIBRETRO_AXIS_LEFT_Y);
+			masks[INPUT_MASK_JOYPAD] |= (y < -threshold ? (1 << RETRO_DEVICE_ID_JOYPAD_UP) : 0)
+				| (y > threshold ? (1 << RETRO_DEVICE_ID_JOYPAD_DOWN) : 0)
+				| (x < -threshold ? (1 << RETRO_DEVICE_ID_JOYPAD_LEFT) : 0)
+				| (x > threshold ? (1 << RETRO_DEVICE_ID_JOYPAD_RIGHT) : 0);
+		}
+
+		if (mapping.analog) {
 			// Fill analogue
+			const auto value = masks[INPUT_MASK_JOYPAD];
 			for (int j = 0; j < 16; ++j) {
-				inputs[i].analogButtons[j] = (value & (1 << j)) ? 1.0f : 0.0f;
+				dst[i].analogButtons[j] = static_cast<float>((value >> j) & 1);
 			}
-			inputs[i].analogButtons[RETRO_DEVICE_ID_JOYPAD_L2] = input->getAxis(LibretroButtons::Axes::LIBRETRO_AXIS_TRIGGER_LEFT);
-			inputs[i].analogButtons[RETRO_DEVICE_ID_JOYPAD_R2] = input->getAxis(LibretroButtons::Axes::LIBRETRO_AXIS_TRIGGER_RIGHT);
+			dst[i].analogButtons[RETRO_DEVICE_ID_JOYPAD_L2] = input->getAxis(LibretroButtons::Axes::LIBRETRO_AXIS_TRIGGER_LEFT);
+			dst[i].analogButtons[RETRO_DEVICE_ID_JOYPAD_R2] = input->getAxis(LibretroButtons::Axes::LIBRETRO_AXIS_TRIGGER_RIGHT);
 
 			// Fill sticks
-			inputs[i].sticks[0] = Vector2f(input->getAxis(LibretroButtons::Axes::LIBRETRO_AXIS_LEFT_X), input->getAxis(LibretroButtons::Axes::LIBRETRO_AXIS_LEFT_Y));
-			inputs[i].sticks[1] = Vector2f(input->getAxis(LibretroButtons::Axes::LIBRETRO_AXIS_RIGHT_X), input->getAxis(LibretroButtons::Axes::LIBRETRO_AXIS_RIGHT_Y));
-
-			// Mouse
-			inputs[i].mouseMovement = Vector2f(input->getAxis(LibretroButtons::Axes::LIBRETRO_AXIS_MOUSE_X), input->getAxis(LibretroButtons::Axes::LIBRETRO_AXIS_MOUSE_Y));
+			dst[i].sticks[0] = Vector2f(input->getAxis(LibretroButtons::Axes::LIBRETRO_AXIS_LEFT_X), input->getAxis(LibretroButtons::Axes::LIBRETRO_AXIS_LEFT_Y));
+			dst[i].sticks[1] = Vector2f(input->getAxis(LibretroButtons::Axes::LIBRETRO_AXIS_RIGHT_X), input->getAxis(LibretroButtons::Axes::LIBRETRO_AXIS_RIGHT_Y));
+		}
 
-			// Lightgun
-			inputs[i].lightGunPos = Vector2f(input->getAxis(LibretroButtons::Axes::LIBRETRO_AXIS_LIGHTGUN_X), input->getAxis(LibretroButtons::Axes::LIBRETRO_AXIS_LIGHTGUN_Y));
+		if (mapping.mouse) {
+			dst[i].mouseMovement = Vector2f(input->getAxis(LibretroButtons::Axes::LIBRETRO_AXIS_MOUSE_X), input->getAxis(LibretroButtons::Axes::LIBRETRO_AXIS_MOUSE_Y));
+		}
 
-			inputs[i].buttonMask = value;
-			inputs[i].mouseMask = mouseValue;
-			inputs[i].lightGunMask = lightGunValue;
+		if (mapping.lightGun) {
+			dst[i].lightGunPos = Vector2f(input->getAxis(LibretroButtons::Axes::LIBRETRO_AXIS_LIGHTGUN_X), input->getAxis(LibretroButtons::Axes::LIBRETRO_AXIS_LIGHTGUN_Y));
 		}
+
+		dst[i].buttonMask = masks[INPUT_MASK_JOYPAD];
+		dst[i].mouseMask = masks[INPUT_MASK_MOUSE];
+		dst[i].lightGunMask = masks[INPUT_MASK_LIGHTGUN];
 	}
 }
 
 int16_t LibretroCore::onInputState(uint32_t port, uint32_t device, uint32_t index, uint32_t id)
+{
+	// The movie checks the core asks for the same inputs in the same order when replaying
+	if (moviePlayback && !runningHiddenFrame) {
+		return moviePlayback->readValue(port, device, index, id);
+	}
+
+	const auto value = readInputState(port, device, index, id);
+	if (movieRecording && !movieRecordingStopped && !runningHiddenFrame) {
+		movieRecording->recordValue(port, device, index, id, value);
+	}
+	return value;
+}
+
+int16_t LibretroCore::readInputState(uint32_t port, uint32_t device, uint32_t index, uint32_t id)
 {
 	auto floatToInt = [&](float value) -> int16_t
 	{
@@ -1361,6 +2307,12 @@ int16_t LibretroCore::onInputState(uint32_t port, uint32_t device, uint32_t inde
 	const auto& input = inputs[port];
 
 	const auto maskedDevice = device & RETRO_DEVICE_MASK;
+	if (!inputDeviceUsageKnown) {
+		// First query tells us the core has started reading input, from now on only poll what it uses
+		inputDeviceUsageKnown = true;
+		inputMappingsDirty = true;
+	}
+	markInputDeviceUsed(port, maskedDevice);
 
 	if (maskedDevice == RETRO_DEVICE_JOYPAD) {
 		if (id == RETRO_DEVICE_ID_JOYPAD_MASK) {
@@ -1454,7 +2406,7 @@ bool LibretroCore::onSetRumbleState(uint32_t port, retro_rumble_effect effect, u
 	if (port > maxInputDevices) {
 		return false;
 	}
-	auto device = inputs[port].device;
+	auto device = inputDevices[port];
 	if (!device) {
 		return false;
 	}
@@ -1494,6 +2446,11 @@ void LibretroCore::onEnvSetRotation(uint32_t data)
 
 bool LibretroCore::onEnvSetHWRender(retro_hw_render_callback& data)
 {
+	if (!environment.getHalleyAPI().video) {
+		Logger::logError("Hardware rendering is not available without a video device.");
+		return false;
+	}
+
 	if (data.context_type == RETRO_HW_CONTEXT_DIRECT3D || data.context_type == RETRO_HW_CONTEXT_OPENGL || data.context_type == RETRO_HW_CONTEXT_OPENGL_CORE) {
 		hwRenderCallback = data;
 		renderCallbackNeedsReset = true;
@@ -1524,6 +2481,36 @@ bool LibretroCore::onEnvGetHWRenderInterface(const retro_hw_render_interface** d
 	return *data != nullptr;
 }
 
+bool LibretroCore::onEnvGetCurrentSoftwareFramebuffer(retro_framebuffer& data)
+{
+	if (hwRenderCallback || !cpuUpdateTexture || data.width == 0 || data.height == 0) {
+		return false;
+	}
+
+	const size_t bytesPerPixel = systemAVInfo.pixelFormat == RETRO_PIXEL_FORMAT_XRGB8888 ? 4 : 2;
+	const size_t pitch = data.width * bytesPerPixel;
+	const size_t size = pitch * data.height;
+
+	// Hand out the memory the frame would be copied into anyway: the capture target if capturing, or the next upload staging buffer
+	void* buffer = nullptr;
+	if (videoCapture) {
+		videoCapture->data.resize(size);
+		buffer = videoCapture->data.data();
+	} else if (convertPixelFormat) {
+		// Conversion writes to the staging buffer, so it can't also be the source
+		softwareFramebuffer.resize(size);
+		buffer = softwareFramebuffer.data();
+	} else {
+		buffer = cpuUpdateTexture->getNextStagingBuffer(size).data();
+	}
+
+	data.data = buffer;
+	data.pitch = pitch;
+	data.format = systemAVInfo.pixelFormat;
+	data.memory_flags = RETRO_MEMORY_TYPE_CACHED;
+	return true;
+}
+
 const retro_hw_render_interface* LibretroCore::getD3DHWRenderInterface()
 {
 #ifdef WITH_DX11
@@ -1552,7 +2539,11 @@ int LibretroCore::onEnvGetAudioVideoEnable()
 	constexpr int enableAudio = 0x2;
 	constexpr int fastSaveState = 0x4;
 	constexpr int hardDisableAudio = 0x8;
-	return (fastForwarding ? 0 : enableVideo | enableAudio) | (saveStateType == SaveStateType::RewindRecording ? fastSaveState : 0);
+	const bool fastSave = saveStateType != SaveStateType::Normal;
+	return (fastForwarding || !videoEnabled ? 0 : enableVideo)
+		| (fastForwarding || fastForwardActive || !audioEnabled ? 0 : enableAudio)
+		| (fastSave ? fastSaveState : 0)
+		| (isSecondInstance ? hardDisableAudio : 0);
 }
 
 void LibretroCore::onEnvGetSystemDirectory(const char** data)
@@ -1640,6 +2631,78 @@ void LibretroCore::onEnvSetMessageExt(const retro_message_ext& data)
 	Logger::log(halleyLevel, "[" + systemInfo.coreName + "] " + data.msg);
 }
 
+void LibretroCore::onPerfRegister(retro_perf_counter* counter)
+{
+	std::unique_lock<std::mutex> lock(perfCountersMutex);
+	if (!counter->registered) {
+		counter->registered = true;
+		perfCounters.push_back(PerfCounterStats{ counter, counter->total });
+	}
+}
+
+void LibretroCore::onPerfStart(retro_perf_counter* counter)
+{
+	counter->call_cnt++;
+	counter->start = retroPerfGetCounter();
+
+	if (perfEventDepth < maxPerfEventDepth) {
+		perfEventCounters[perfEventDepth] = counter;
+		perfEvents[perfEventDepth].emplace(ProfilerEventType::ExternalCode, counter->ident ? counter->ident : "perf_counter");
+	}
+	++perfEventDepth;
+}
+
+void LibretroCore::onPerfStop(retro_perf_counter* counter)
+{
+	counter->total += retroPerfGetCounter() - counter->start;
+
+	// Counters are normally nested, but close any that the core forgot to stop, so the events don't leak
+	while (perfEventDepth > 0) {
+		--perfEventDepth;
+		if (perfEventDepth < maxPerfEventDepth) {
+			perfEvents[perfEventDepth].reset();
+			if (perfEventCounters[perfEventDepth] == counter) {
+				break;
+			}
+		}
+	}
+}
+
+void LibretroCore::onPerfLog()
+{
+	logPerfCounters();
+}
+
+void LibretroCore::updatePerfCounters()
+{
+	std::unique_lock<std::mutex> lock(perfCountersMutex);
+	for (auto& stats: perfCounters) {
+		const auto total = stats.counter->total;
+		stats.maxPerFrame = std::max(stats.maxPerFrame, total - stats.lastTotal);
+		stats.lastTotal = total;
+		++stats.frames;
+	}
+}
+
+void LibretroCore::logPerfCounters() const
+{
+	std::unique_lock<std::mutex> lock(perfCountersMutex);
+	if (perfCounters.empty()) {
+		return;
+	}
+
+	// Ticks are nanoseconds, see retroPerfGetCounter()
+	auto ms = [] (double ticks) { return toString(ticks / 1000000.0, 3) + " ms"; };
+
+	Logger::logInfo("Core perf counters:");
+	for (const auto& stats: perfCounters) {
+		const auto* counter = stats.counter;
+		const auto frames = std::max(stats.frames, static_cast<uint64_t>(1));
+		Logger::logInfo("  " + String(counter->ident ? counter->ident : "?") + ": " + toString(counter->call_cnt) + " calls, " + ms(static_cast<double>(counter->total)) + " total, "
+			+ ms(static_cast<double>(counter->total) / frames) + "/frame avg, " + ms(static_cast<double>(stats.maxPerFrame)) + "/frame max");
+	}
+}
+
 void LibretroCore::onEnvGetPerfInterface(retro_perf_callback& data)
 {
 	data.get_cpu_features = &retroGetCpuFeatures;
@@ -1789,6 +2852,21 @@ void LibretroCore::onEnvSetMinimumAudioLatency(uint32_t data)
 	//audioOut->setLatencyTarget(std::max(1024u, data * 48));
 }
 
+bool LibretroCore::onEnvSetAudioCallback(const retro_audio_callback* data)
+{
+	if (isSecondInstance) {
+		// No audio output to drive it
+		return false;
+	}
+
+	if (data && data->callback) {
+		audioCallback = *data;
+	} else {
+		audioCallback.reset();
+	}
+	return true;
+}
+
 std::shared_ptr<Texture> LibretroCore::getDX11HWTexture(Vector2i size)
 {
 	auto& dx11Video = static_cast<DX11Video&>(*environment.getHalleyAPI().video);
@@ -1826,10 +2904,27 @@ TextureFormat LibretroCore::getTextureFormat(retro_pixel_format retroFormat) con
 	}
 }
 
+PixelConvert::Format LibretroCore::getPixelConvertFormat(retro_pixel_format retroFormat) const
+{
+	switch (retroFormat) {
+	case RETRO_PIXEL_FORMAT_0RGB1555:
+		return PixelConvert::Format::XRGB1555;
+	case RETRO_PIXEL_FORMAT_RGB565:
+		return PixelConvert::Format::RGB565;
+	case RETRO_PIXEL_FORMAT_XRGB8888:
+	case RETRO_PIXEL_FORMAT_UNKNOWN:
+	default:
+		return PixelConvert::Format::XRGB8888;
+	}
+}
+
 void LibretroCore::pushInstance() const
 {
 	if (curInstanceDepth == 0) {
 		curInstance = const_cast<LibretroCore*>(this);
+		if (!isSecondInstance) {
+			lastInstance = curInstance;
+		}
 	} else {
 		assert(curInstance == this);
 	}
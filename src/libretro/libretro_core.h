@@ -1,13 +1,16 @@
 #pragma once
 
 #include <halley.hpp>
+#include <condition_variable>
 
 #include "libretro.h"
 #include "src/util/c_string_cache.h"
 #include "src/util/dll.h"
 #include "src/util/dx11_state.h"
+#include "src/util/pixel_convert.h"
 
 class CoreConfig;
+class InputMovie;
 
 namespace Halley {
 	class DX11Texture;
@@ -18,6 +21,7 @@ class LibretroVFS;
 class CPUUpdateTexture;
 class RetrogradeEnvironment;
 class OpenGLInterop;
+class WorkerThread;
 using namespace Halley;
 
 class ILibretroCoreCallbacks {
@@ -35,11 +39,22 @@ public:
 	virtual uintptr_t onHWGetCurrentFrameBuffer() = 0;
 	virtual retro_proc_address_t onHWGetProcAddress(const char* sym) = 0;
 	virtual bool onSetRumbleState(uint32_t port, retro_rumble_effect effect, uint16_t strength) = 0;
+	virtual void onPerfRegister(retro_perf_counter* counter) = 0;
+	virtual void onPerfStart(retro_perf_counter* counter) = 0;
+	virtual void onPerfStop(retro_perf_counter* counter) = 0;
+	virtual void onPerfLog() = 0;
 
 	virtual LibretroVFS& getVFS() = 0;
 
-	static ILibretroCoreCallbacks* curInstance;
-	static size_t curInstanceDepth;
+	static ILibretroCoreCallbacks& getCurrentInstance();
+
+protected:
+	// The instance is tracked per thread, so several cores can run concurrently on different threads
+	static thread_local ILibretroCoreCallbacks* curInstance;
+	static thread_local size_t curInstanceDepth;
+
+	// Used for callbacks made from threads owned by the core itself
+	static std::atomic<ILibretroCoreCallbacks*> lastInstance;
 };
 
 class LibretroCore : protected ILibretroCoreCallbacks {
@@ -112,6 +127,48 @@ public:
 		bool operator!=(const ControllerType& other) const;
 	};
 
+	struct RunAheadTiming {
+		Time realFrame = 0;
+		Time saveState = 0;
+		Time hiddenFrames = 0;
+		Time loadState = 0;
+
+		Time getTotal() const;
+	};
+
+	struct InputLatencyStats {
+		uint64_t polls = 0;
+		Time totalAge = 0;
+		Time maxAge = 0;
+
+		String toString() const;
+	};
+
+	struct FrameTiming {
+		Time core = 0; // Time spent inside retro_run, excluding frontend callbacks
+		Time frontend = 0; // Everything else in runFrame, including callbacks
+	};
+
+	struct InputState {
+		int16_t buttonMask = 0;
+		int16_t mouseMask = 0;
+		int16_t lightGunMask = 0;
+		std::array<Vector2f, 2> sticks;
+		std::array<float, 16> analogButtons;
+		Vector2f mouseMovement;
+		Vector2f lightGunPos;
+	};
+
+	constexpr static int maxInputDevices = 10;
+	using InputSnapshot = std::array<InputState, maxInputDevices>;
+
+	struct VideoFrame {
+		Bytes data;
+		Vector2i size;
+		int pitch = 0;
+		bool dupe = true;
+	};
+
 	struct PortControllerTypes {
 		Vector<ControllerType> types;
 		size_t curTypeIdx = 0;
@@ -136,27 +193,62 @@ public:
 	bool saveState(SaveStateType type, gsl::span<gsl::byte> bytes) const;
 	bool loadState(gsl::span<const gsl::byte> bytes);
 	bool loadState(const Bytes& bytes);
+	bool loadState(SaveStateType type, gsl::span<const gsl::byte> bytes);
 
 	gsl::span<Byte> getMemory(MemoryType type);
 
 	void setRewinding(bool rewind);
-	void setFastFowarding(bool ffwd);
+	void setFastFowarding(bool ffwd); // Frame output won't be shown, so the core may skip producing it
+	void setFastForwardState(bool active, float speed);
+	std::optional<retro_fastforwarding_override> getFastForwardOverride() const;
 	void setPaused(bool paused);
 	void runFrame();
+	void runFrameWithRunAhead(int frames);
+	bool startSecondInstance();
+	void finishRunAhead();
+	const RunAheadTiming& getRunAheadTiming() const;
+	const FrameTiming& getLastFrameTiming() const;
+
+	void setVideoCapture(VideoFrame* target);
+	void presentVideoFrame(const VideoFrame& frame);
 	const Sprite& getVideoOut() const;
-	std::unique_ptr<Image> getLastScreenImage() const;
+	// Software frames are copied out of the upload staging memory, hardware ones read back from the GPU. Conversion to RGBA happens on a worker.
+	Future<std::shared_ptr<Image>> getLastScreenImage() const;
+
+	// Captures a downscaled copy of the next software rendered frame, so it can be grabbed without a GPU readback
+	void requestThumbnail(int maxWidth);
+	std::unique_ptr<Image> takeThumbnail();
 
 	const CoreConfig& getCoreConfig() const;
 	const SystemInfo& getSystemInfo() const;
 	const SystemAVInfo& getSystemAVInfo() const;
 	bool isScreenRotated() const;
+	bool hasHardwareRendering() const;
 
 	LibretroVFS& getVFS() override;
 
 	void setInputDevice(int port, std::shared_ptr<InputVirtual> input);
+	const InputSnapshot& getInputSnapshot() const;
+	void setInputSnapshot(const InputSnapshot& snapshot);
+	void setExternalInput(bool enabled);
+	void pollInputDevices(InputSnapshot& dst);
+	const InputLatencyStats& getInputLatencyStats() const;
+	void resetInputLatencyStats();
 	void setControllerType(int port, size_t typeIdx);
 	const Vector<PortControllerTypes> getControllerTypes() const;
 
+	// Movies log every input value the core reads from the current state onwards, playing one back feeds those values instead of the devices.
+	// Loading any other state stops both, as the inputs would no longer match.
+	// Rewind snapshots are instead tagged with getMoviePosition(), so rewinding while recording cuts the movie back to that point and carries on.
+	bool startMovieRecording();
+	std::shared_ptr<InputMovie> stopMovieRecording();
+	bool isRecordingMovie() const;
+	uint64_t getMoviePosition() const;
+	bool loadRewindState(const Bytes& bytes, uint64_t moviePosition);
+	bool startMoviePlayback(std::shared_ptr<InputMovie> movie);
+	void stopMoviePlayback();
+	bool isPlayingMovie() const;
+
 	const HashMap<String, Option>& getOptions() const;
 	void setOption(const String& key, const String& value);
 
@@ -174,8 +266,44 @@ protected:
 	uintptr_t onHWGetCurrentFrameBuffer() override;
 	retro_proc_address_t onHWGetProcAddress(const char* sym) override;
 	bool onSetRumbleState(uint32_t port, retro_rumble_effect effect, uint16_t strength) override;
+	void onPerfRegister(retro_perf_counter* counter) override;
+	void onPerfStart(retro_perf_counter* counter) override;
+	void onPerfStop(retro_perf_counter* counter) override;
+	void onPerfLog() override;
 
 private:
+	struct InputButtonMapping {
+		int button = 0;
+		uint8_t target = 0;
+		uint8_t bit = 0;
+	};
+
+	// Which parts of a device to read on poll, rebuilt when bindings or the devices used by the core change
+	struct InputPortMapping {
+		Vector<InputButtonMapping> buttons;
+		bool active = true;
+		bool dpadFromStick = false;
+		bool analog = true;
+		bool mouse = true;
+		bool lightGun = true;
+	};
+
+	struct PerfCounterStats {
+		retro_perf_counter* counter = nullptr;
+		retro_perf_tick_t lastTotal = 0;
+		retro_perf_tick_t maxPerFrame = 0;
+		uint64_t frames = 0;
+	};
+
+	// Open profiler events for perf counters, per thread, as cores can time code on their own threads
+	constexpr static size_t maxPerfEventDepth = 32;
+	static thread_local std::array<std::optional<ProfilerEvent>, maxPerfEventDepth> perfEvents;
+	static thread_local std::array<retro_perf_counter*, maxPerfEventDepth> perfEventCounters;
+	static thread_local size_t perfEventDepth;
+
+	// Set on the thread running retro_run, so callbacks from the core's other threads aren't counted as frontend time
+	static thread_local bool insideRetroRun;
+
 	const CoreConfig& coreConfig;
 	DLL dll;
 	const RetrogradeEnvironment& environment;
@@ -186,12 +314,25 @@ private:
 	bool coreHandlesSaveData = false;
 	bool hasAnalogStick = false;
 	bool needsToSaveSRAM = false;
-	bool rewinding = false;
+	std::atomic<bool> rewinding = false;
 	bool fastForwarding = false;
-	bool paused = false;
+	std::atomic<bool> fastForwardActive = false;
+	std::atomic<float> fastForwardSpeed = 0;
+	std::optional<retro_fastforwarding_override> fastForwardOverride;
+	mutable std::mutex fastForwardOverrideMutex; // Set by the core from the emulation thread, read by the UI
+	std::atomic<bool> paused = false; // Also read by the audio callback thread
 	bool lastFrameIsCPU = true;
+	bool videoEnabled = true;
+	bool audioEnabled = true;
+	bool runningHiddenFrame = false;
+	bool runAheadFailed = false;
+	bool runAheadPending = false;
+	bool secondInstanceFailed = false;
+	bool isSecondInstance = false;
+	bool externalInput = false;
 
 	String gameName;
+	Path gamePath;
 	String systemId;
 	Bytes gameBytes;
 	Vector<retro_game_info_ext> gameInfos;
@@ -209,25 +350,33 @@ private:
 
 	Sprite videoOut;
 	std::unique_ptr<CPUUpdateTexture> cpuUpdateTexture;
+	Bytes softwareFramebuffer;
+	bool convertPixelFormat = false;
 
 	std::shared_ptr<AudioClipStreaming> audioOut;
-	Vector<float> audioBuffer;
+	Vector<float> audioPending;
+	size_t audioPendingCount = 0;
+	std::array<float, 256> audioSampleBuffer;
+	size_t audioSampleCount = 0;
+	Vector<float> audioConvertBuffer;
 	retro_audio_buffer_status_callback_t audioBufferStatusCallback = nullptr;
-	std::shared_ptr<SingleThreadExecutor> audioThread;
+	std::optional<retro_audio_callback> audioCallback;
+	std::unique_ptr<WorkerThread> audioThread;
+	std::atomic<bool> audioCallbackRunning = false;
+	std::atomic<bool> audioCallbackActive = false;
+	std::mutex audioMutex;
+	std::mutex audioCallbackWakeMutex;
+	std::condition_variable audioCallbackWake;
 	AudioHandle audioStreamHandle;
 
-	constexpr static int maxInputDevices = 10;
-	struct Input {
-		int16_t buttonMask = 0;
-		int16_t mouseMask = 0;
-		int16_t lightGunMask = 0;
-		std::array<Vector2f, 2> sticks;
-		std::array<float, 16> analogButtons;
-		Vector2f mouseMovement;
-		Vector2f lightGunPos;
-		std::shared_ptr<InputVirtual> device;
-	};
-	std::array<Input, maxInputDevices> inputs;
+	InputSnapshot inputs;
+	std::array<std::shared_ptr<InputVirtual>, maxInputDevices> inputDevices;
+	std::array<InputPortMapping, maxInputDevices> inputMappings;
+	std::array<std::atomic<uint32_t>, maxInputDevices> inputDeviceUsage = {}; // Bitmask of 1 << RETRO_DEVICE_*
+	std::atomic<bool> inputDeviceUsageKnown = false;
+	std::atomic<bool> inputMappingsDirty = true;
+	int64_t lastInputUpdateTime = 0;
+	InputLatencyStats inputLatencyStats;
 
 	std::unique_ptr<LibretroVFS> vfs;
 	std::optional<retro_disk_control_ext_callback> diskControlCallbacks;
@@ -241,6 +390,28 @@ private:
 	std::shared_ptr<DX11State> dx11State;
 
 	CStringCache stringCache;
+
+	Vector<PerfCounterStats> perfCounters;
+	mutable std::mutex perfCountersMutex; // Cores may register counters from any thread, including the audio callback's
+
+	Bytes runAheadState;
+	RunAheadTiming runAheadTiming;
+	RunAheadTiming runAheadTimingAccumulated;
+	RunAheadTiming pendingRunAheadTiming;
+	int runAheadTimingFrames = 0;
+	int pendingRunAheadFrames = 0;
+	FrameTiming lastFrameTiming;
+	int64_t callbackTime = 0; // Only touched by the thread running retro_run
+	std::unique_ptr<LibretroCore> secondInstance;
+	std::unique_ptr<WorkerThread> runAheadWorker;
+	VideoFrame runAheadFrame;
+	VideoFrame* videoCapture = nullptr;
+	int thumbnailMaxWidth = 0;
+	std::unique_ptr<Image> thumbnail;
+	std::shared_ptr<InputMovie> movieRecording;
+	std::shared_ptr<InputMovie> moviePlayback;
+	bool movieRecordingStopped = false;
+	uint32_t movieRecordingId = 0;
 	
 	LibretroCore(DLL dll, const CoreConfig& coreConfig, String systemId, const RetrogradeEnvironment& environment);
 
@@ -257,6 +428,30 @@ private:
 	void loadVFS();
 
 	void addAudioSamples(gsl::span<const float> samples);
+	void flushAudio();
+	std::unique_lock<std::mutex> lockAudio();
+	void startAudioCallback();
+	void stopAudioCallback();
+	void runAudioCallback();
+
+	void setAudioVideoEnabled(bool video, bool audio);
+	void runFrameWithSecondInstance(int frames);
+	void stopSecondInstance();
+	void outputVideoFrame(const VideoFrame& frame);
+	void captureVideoFrame(const void* data, Vector2i size, size_t pitch);
+	void captureThumbnail(const void* data, Vector2i size, size_t pitch);
+	void uploadVideoFrame(const void* data, Vector2i size, size_t pitch);
+	void uploadSoftwareFrame(const void* data, Vector2i size, size_t pitch);
+	void onRunAheadTiming(const RunAheadTiming& timing, int frames);
+	void addCallbackTime(int64_t startTime);
+
+	bool unserializeState(SaveStateType type, gsl::span<const gsl::byte> bytes);
+	int16_t readInputState(uint32_t port, uint32_t device, uint32_t index, uint32_t id);
+	void markInputDeviceUsed(uint32_t port, uint32_t device);
+	void updateInputMappings();
+
+	void updatePerfCounters();
+	void logPerfCounters() const;
 
 	void saveGameDataIfNeeded();
 	void saveGameData(gsl::span<Byte> data);
@@ -278,6 +473,7 @@ private:
 	bool onEnvSetHWRender(retro_hw_render_callback& data);
 	uint32_t onEnvGetPreferredHWRender();
 	bool onEnvGetHWRenderInterface(const retro_hw_render_interface** data);
+	bool onEnvGetCurrentSoftwareFramebuffer(retro_framebuffer& data);
 	const retro_hw_render_interface* getD3DHWRenderInterface();
 
 	void onEnvGetSaveDirectory(const char** data);
@@ -289,6 +485,8 @@ private:
 	void onEnvSetContentInfoOverride(const retro_system_content_info_override* data);
 
 	void onEnvSetInputDescriptors(const retro_input_descriptor* data);
+	bool onEnvSetFastForwardingOverride(const retro_fastforwarding_override* data);
+	void onEnvGetThrottleState(retro_throttle_state& data);
 	void onEnvSetControllerInfo(const retro_controller_info* data);
 	void onEnvGetRumbleInterface(retro_rumble_interface& data);
 
@@ -306,10 +504,12 @@ private:
 
 	void onEnvSetAudioBufferStatusCallback(const retro_audio_buffer_status_callback* data);
 	void onEnvSetMinimumAudioLatency(uint32_t data);
+	bool onEnvSetAudioCallback(const retro_audio_callback* data);
 
 	std::shared_ptr<Texture> getDX11HWTexture(Vector2i size);
 	std::shared_ptr<Texture> getOpenGLHWTexture();
 	TextureFormat getTextureFormat(retro_pixel_format retroFormat) const;
+	PixelConvert::Format getPixelConvertFormat(retro_pixel_format retroFormat) const;
 
 	void pushInstance() const;
 	void popInstance() const;
@@ -0,0 +1,204 @@
+#include "benchmark_stage.h"
+
+#include "retrograde_environment.h"
+#include "src/config/core_config.h"
+#include "src/config/screen_filter_config.h"
+#include "src/config/system_config.h"
+#include "src/filter_chain/filter_chain.h"
+#include "src/libretro/libretro_core.h"
+#include "src/savestate/input_movie.h"
+
+bool BenchmarkStage::Config::needsVideo() const
+{
+	return uploadVideo || filterChain;
+}
+
+BenchmarkStage::BenchmarkStage(RetrogradeEnvironment& env, Config config)
+	: env(env)
+	, config(std::move(config))
+{
+}
+
+BenchmarkStage::~BenchmarkStage()
+{
+	filterChain.reset();
+	core.reset();
+}
+
+void BenchmarkStage::init()
+{
+	samples.reserve(config.frames);
+
+	if (!loadCore()) {
+		finish(1);
+	}
+}
+
+bool BenchmarkStage::loadCore()
+{
+	const auto* systemConfig = env.getConfigDatabase().tryGet<SystemConfig>(config.systemId);
+	if (!systemConfig || (systemConfig->getCores().empty() && !config.coreId)) {
+		Logger::logError("Benchmark: unknown system or no core for \"" + config.systemId + "\"");
+		return false;
+	}
+
+	const auto coreId = config.coreId.value_or(systemConfig->getCores().empty() ? String() : systemConfig->getCores().front());
+	const auto* coreConfig = env.getConfigDatabase().tryGet<CoreConfig>(coreId);
+	if (!coreConfig) {
+		Logger::logError("Benchmark: unknown core \"" + coreId + "\"");
+		return false;
+	}
+
+	core = env.loadCore(*coreConfig, *systemConfig);
+	if (!core) {
+		return false;
+	}
+	for (const auto& [k, v]: config.coreOptions) {
+		core->setOption(k, v);
+	}
+
+	const auto romPath = Path(config.romPath).isAbsolute() ? Path(config.romPath) : env.getRomsDir(config.systemId) / config.romPath;
+	if (!core->loadGame(romPath)) {
+		Logger::logError("Benchmark: failed to load " + romPath.getString());
+		return false;
+	}
+
+	if (core->hasHardwareRendering()) {
+		Logger::logError("Benchmark: hardware rendered cores are not supported.");
+		return false;
+	}
+
+	if (config.moviePath) {
+		std::shared_ptr<InputMovie> movie;
+		try {
+			const auto bytes = Path::readFile(Path(*config.moviePath));
+			if (!bytes.empty()) {
+				movie = std::make_shared<InputMovie>(bytes.byte_span());
+			}
+		} catch (const std::exception& e) {
+			Logger::logError(String("Benchmark: ") + e.what());
+		}
+		if (!movie) {
+			Logger::logError("Benchmark: failed to read movie " + *config.moviePath);
+			return false;
+		}
+		if (!core->startMoviePlayback(std::move(movie))) {
+			return false;
+		}
+		playingMovie = true;
+	}
+
+	if (config.filterChain && !systemConfig->getScreenFilters().empty()) {
+		const auto& screenFilterConfig = env.getConfigDatabase().get<ScreenFilterConfig>(systemConfig->getScreenFilters().front());
+		const auto windowSize = getVideoAPI().getWindow().getWindowRect().getSize();
+		const auto& shader = screenFilterConfig.getShaderFor(windowSize);
+		if (!shader.isEmpty()) {
+			filterChain = env.makeFilterChain(shader);
+		}
+	}
+
+	Logger::logInfo("Benchmark: running " + toString(config.frames) + " frames of " + romPath.getFilename().getString() + " on " + coreConfig->getId()
+		+ " [upload " + (config.uploadVideo ? "on" : "off") + ", filter chain " + (filterChain ? "on" : "off") + ", movie " + (playingMovie ? "on" : "off") + "]");
+	return true;
+}
+
+void BenchmarkStage::onVariableUpdate(Time)
+{
+	if (finished) {
+		return;
+	}
+
+	if (filterChain) {
+		// The filter chain runs once per render, so frames have to be interleaved with it
+		runFrame();
+	} else {
+		// Run in batches, so the main loop still gets to tick every now and then
+		const auto batchStart = std::chrono::steady_clock::now();
+		while (!finished && std::chrono::steady_clock::now() - batchStart < std::chrono::milliseconds(100)) {
+			runFrame();
+		}
+	}
+}
+
+void BenchmarkStage::onRender(RenderContext& rc) const
+{
+	if (!filterChain || !core) {
+		return;
+	}
+
+	const auto& videoOut = core->getVideoOut();
+	if (videoOut.hasMaterial()) {
+		const auto start = std::chrono::steady_clock::now();
+		const auto windowSize = getVideoAPI().getWindow().getWindowRect().getSize();
+		filterChain->run(videoOut, rc, windowSize);
+		filterTime += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+}
+
+void BenchmarkStage::runFrame()
+{
+	const auto start = std::chrono::steady_clock::now();
+	core->runFrame();
+	const Time total = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	++framesRun;
+	if (framesRun <= config.warmupFrames) {
+		filterTime = 0;
+		return;
+	}
+
+	const auto& timing = core->getLastFrameTiming();
+	// Filter time from the previous render is attributed to this frame
+	samples.push_back(FrameSample{ total + filterTime, timing.core, timing.frontend + filterTime });
+	wallTime += total + filterTime;
+	filterTime = 0;
+
+	if (static_cast<int>(samples.size()) >= config.frames || (playingMovie && !core->isPlayingMovie())) {
+		printResults();
+		finish(0);
+	}
+}
+
+void BenchmarkStage::finish(int exitCode)
+{
+	finished = true;
+	core.reset();
+	getCoreAPI().quit(exitCode);
+}
+
+void BenchmarkStage::printResults() const
+{
+	if (samples.empty()) {
+		return;
+	}
+
+	Vector<Time> totals;
+	totals.reserve(samples.size());
+	Time coreTotal = 0;
+	Time frontendTotal = 0;
+	for (const auto& sample: samples) {
+		totals.push_back(sample.total);
+		coreTotal += sample.core;
+		frontendTotal += sample.frontend;
+	}
+	std::sort(totals.begin(), totals.end());
+
+	auto percentile = [&] (double p) -> Time
+	{
+		const auto idx = static_cast<size_t>(p * static_cast<double>(totals.size() - 1) + 0.5);
+		return totals[idx];
+	};
+	auto ms = [] (Time t) -> String
+	{
+		return toString(t * 1000.0, 3) + " ms";
+	};
+
+	const auto n = static_cast<double>(samples.size());
+	const auto coreShare = coreTotal / std::max(coreTotal + frontendTotal, 0.000001);
+
+	Logger::logInfo("Benchmark results over " + toString(samples.size()) + " frames:");
+	Logger::logInfo("  FPS:       " + toString(n / wallTime, 1));
+	Logger::logInfo("  Frame:     p50 " + ms(percentile(0.5)) + ", p90 " + ms(percentile(0.9)) + ", p99 " + ms(percentile(0.99)) + ", max " + ms(totals.back()));
+	Logger::logInfo("  Core:      avg " + ms(coreTotal / n) + " (" + toString(coreShare * 100.0, 1) + "%)");
+	Logger::logInfo("  Frontend:  avg " + ms(frontendTotal / n) + " (" + toString((1.0 - coreShare) * 100.0, 1) + "%)");
+}
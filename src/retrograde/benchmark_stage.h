@@ -0,0 +1,59 @@
+#pragma once
+
+#include <halley.hpp>
+class RetrogradeEnvironment;
+class LibretroCore;
+class FilterChain;
+class SystemConfig;
+using namespace Halley;
+
+// Runs a core as fast as possible and reports timings, without requiring a window, audio or vsync
+class BenchmarkStage : public Stage {
+public:
+    struct Config {
+        String systemId;
+        String romPath;
+        std::optional<String> coreId;
+        HashMap<String, String> coreOptions;
+        std::optional<String> moviePath; // Replays recorded input, stopping early if the movie ends first
+        int frames = 3000;
+        int warmupFrames = 60;
+        bool uploadVideo = false;
+        bool filterChain = false;
+
+        bool needsVideo() const;
+    };
+
+    BenchmarkStage(RetrogradeEnvironment& env, Config config);
+    ~BenchmarkStage() override;
+
+    void init() override;
+
+    void onVariableUpdate(Time) override;
+    void onRender(RenderContext&) const override;
+
+private:
+    struct FrameSample {
+        Time total = 0;
+        Time core = 0;
+        Time frontend = 0;
+    };
+
+    RetrogradeEnvironment& env;
+    Config config;
+
+    std::unique_ptr<LibretroCore> core;
+    std::unique_ptr<FilterChain> filterChain;
+
+    Vector<FrameSample> samples;
+    int framesRun = 0;
+    Time wallTime = 0;
+    mutable Time filterTime = 0;
+    bool finished = false;
+    bool playingMovie = false;
+
+    bool loadCore();
+    void runFrame();
+    void finish(int exitCode);
+    void printResults() const;
+};
@@ -4,13 +4,19 @@
 #include "retrograde_game.h"
 #include "src/retrograde/retrograde_environment.h"
 #include "src/ui/choose_system_window.h"
+#include "src/util/frame_trace.h"
 
 GameStage::GameStage(RetrogradeEnvironment& env)
 	: env(env)
 {
 }
 
-GameStage::~GameStage() = default;
+GameStage::~GameStage()
+{
+	if (tracePath) {
+		FrameTrace::exportChromeTrace(*tracePath);
+	}
+}
 
 void GameStage::init()
 {
@@ -18,6 +24,8 @@ void GameStage::init()
 	perfStats->setActive(false);
 
 	auto& game = dynamic_cast<RetrogradeGame&>(getGame());
+	tracePath = game.getTracePath();
+	FrameTrace::setThreadName("main");
 
 	std::optional<String> systemId;
 	std::optional<String> gamePath;
@@ -54,11 +62,16 @@ void GameStage::init()
 
 void GameStage::onVariableUpdate(Time t)
 {
+	// Runs once per display refresh, core frames are scheduled from here by the frame pacer
+	// The engine pumps OS events right before calling this, so this is when this tick's input arrived
+	env.onInputEventsPumped();
+	FrameTrace::beginFrame();
+	TraceScope trace("update");
+	onUpdate(t);
 }
 
 void GameStage::onFixedUpdate(Time t)
 {
-	onUpdate(t);
 }
 
 void GameStage::onUpdate(Time t)
@@ -82,6 +95,9 @@ void GameStage::onUpdate(Time t)
 	auto uiInput = env.getInputMapper().getUIInput();
 	uiRoot->update(t, UIInputType::Mouse, getInputAPI().getMouse(), uiInput);
 
+	if (kb->isButtonPressed(KeyCode::F9)) {
+		dumpTrace();
+	}
 	if (kb->isButtonPressed(KeyCode::F11)) {
 		perfStats->setActive(!perfStats->isActive());
 	}
@@ -90,6 +106,7 @@ void GameStage::onUpdate(Time t)
 
 void GameStage::onRender(RenderContext& rc) const
 {
+	TraceScope trace("render");
 	uiRoot->render(rc);
 
 	Camera camera;
@@ -113,4 +130,12 @@ void GameStage::onRender(RenderContext& rc) const
 			perfStats->paint(painter);
 		}
 	});
+
+	FrameTrace::endFrame();
+}
+
+void GameStage::dumpTrace()
+{
+	const auto path = tracePath ? *tracePath : env.getRootDir() / "trace.json";
+	FrameTrace::exportChromeTrace(path);
 }
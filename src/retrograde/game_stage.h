@@ -24,6 +24,8 @@ private:
 	std::unique_ptr<UIFactory> uiFactory;
 
 	float zoomLevel = 1;
+	std::optional<Path> tracePath;
 
 	void onUpdate(Time t);
+	void dumpTrace();
 };
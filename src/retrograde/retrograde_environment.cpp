@@ -11,6 +11,8 @@
 #include "src/filter_chain/retroarch_filter_chain.h"
 #include "src/libretro/libretro_core.h"
 #include "src/metadata/game_collection.h"
+#include "src/util/dll.h"
+#include "src/util/frame_trace.h"
 #include "src/util/image_cache.h"
 
 RetrogradeEnvironment::RetrogradeEnvironment(RetrogradeGame& game, Path rootDir, Resources& resources, const HalleyAPI& halleyAPI)
@@ -38,7 +40,9 @@ RetrogradeEnvironment::RetrogradeEnvironment(RetrogradeGame& game, Path rootDir,
 	configDatabase.init<MappingConfig>("mappings");
 	configDatabase.load(resources, "db/");
 
-	imageCache = std::make_shared<ImageCache>(*halleyAPI.video, resources, imagesDir);
+	if (halleyAPI.video) {
+		imageCache = std::make_shared<ImageCache>(*halleyAPI.video, resources, imagesDir);
+	}
 
 	settings.load();
 	romsDir = settings.getRomsDir().isAbsolute() ? settings.getRomsDir() : (rootDir / settings.getRomsDir());
@@ -46,6 +50,11 @@ RetrogradeEnvironment::RetrogradeEnvironment(RetrogradeGame& game, Path rootDir,
 	inputMapper = std::make_shared<InputMapper>(*this);
 }
 
+const Path& RetrogradeEnvironment::getRootDir() const
+{
+	return rootDir;
+}
+
 const Path& RetrogradeEnvironment::getSystemDir() const
 {
 	return systemDir;
@@ -103,7 +112,7 @@ RetrogradeGame& RetrogradeEnvironment::getGame() const
 
 std::unique_ptr<LibretroCore> RetrogradeEnvironment::loadCore(const CoreConfig& coreConfig, const SystemConfig& systemConfig)
 {
-	const String corePath = coreConfig.getId() + "_libretro.dll";
+	const String corePath = coreConfig.getId() + "_libretro" + String(DLL::getExtension());
 
 	auto core = LibretroCore::load(coreConfig, getCoresDir() + "/" + corePath, systemConfig.getId(), *this);
 	
@@ -166,3 +175,13 @@ Settings& RetrogradeEnvironment::getSettings()
 {
 	return settings;
 }
+
+void RetrogradeEnvironment::onInputEventsPumped()
+{
+	inputEventsTime = FrameTrace::now();
+}
+
+int64_t RetrogradeEnvironment::getInputEventsTime() const
+{
+	return inputEventsTime;
+}
@@ -17,6 +17,7 @@ class RetrogradeEnvironment {
 public:
 	RetrogradeEnvironment(RetrogradeGame& game, Path rootDir, Resources& resources, const HalleyAPI& halleyAPI);
 
+	const Path& getRootDir() const;
 	const Path& getSystemDir() const;
 	const Path& getCoresDir() const;
 	const Path& getImagesDir() const;
@@ -42,6 +43,10 @@ public:
 
 	Settings& getSettings();
 
+	// When the engine last pumped OS input events, as FrameTrace::now(). Input can't be any fresher than this.
+	void onInputEventsPumped();
+	int64_t getInputEventsTime() const;
+
 private:
 	RetrogradeGame& game;
 	Resources& resources;
@@ -67,4 +72,6 @@ private:
 
 	std::shared_ptr<ImageCache> imageCache;
 	std::shared_ptr<InputMapper> inputMapper;
+
+	std::atomic<int64_t> inputEventsTime = 0;
 };
@@ -1,6 +1,8 @@
 #include "retrograde_game.h"
 #include "game_stage.h"
 #include "retrograde_environment.h"
+#include "src/game/frame_pacer_simulation.h"
+#include "src/util/pixel_convert.h"
 
 void initOpenGLPlugin(IPluginRegistry &registry);
 void initSDLSystemPlugin(IPluginRegistry &registry, std::optional<String> cryptKey);
@@ -14,17 +16,74 @@ void RetrogradeGame::init(const Environment& env, const Vector<String>& args)
 {
 	this->args = args;
 
+	std::optional<int> framesArg;
+	bool benchUpload = false;
+	bool benchFilter = false;
+	std::optional<String> benchCore;
+	HashMap<String, String> benchCoreOptions;
+	std::optional<String> benchMovie;
+
 	for (size_t i = 0; i < args.size(); ++i) {
 		const auto& arg = args[i];
 
 		if (arg.startsWith("--devcon=")) {
 			devConAddress = arg.mid(9);
+		} else if (arg == "--bench" && i + 2 < args.size()) {
+			benchmark = BenchmarkStage::Config();
+			benchmark->systemId = args[++i];
+			benchmark->romPath = args[++i];
+		} else if (arg == "--frames" && i + 1 < args.size()) {
+			framesArg = args[++i].toInteger();
+		} else if (arg == "--core" && i + 1 < args.size()) {
+			benchCore = args[++i];
+		} else if (arg == "--core-option" && i + 1 < args.size()) {
+			const auto option = args[++i].split('=');
+			if (option.size() == 2) {
+				benchCoreOptions[option[0]] = option[1];
+			}
+		} else if (arg == "--bench-movie" && i + 1 < args.size()) {
+			benchMovie = args[++i];
+		} else if (arg == "--bench-upload") {
+			benchUpload = true;
+		} else if (arg == "--bench-filter") {
+			benchFilter = true;
+		} else if (arg.startsWith("--trace=")) {
+			tracePath = Path(arg.mid(8));
+		} else if (arg == "--bench-pixel-convert") {
+			selfTest = [] { PixelConvert::runBenchmark(); return 0; };
+		} else if (arg == "--sim-frame-pacer") {
+			// Checks pacing against simulated displays, the exit code tells whether every scenario passed
+			selfTest = [] { return FramePacerSimulation::run() ? 0 : 1; };
 		}
 	}
+
+	if (benchmark) {
+		benchmark->frames = std::max(framesArg.value_or(benchmark->frames), 1);
+		benchmark->uploadVideo = benchUpload || benchFilter; // The filter chain needs the uploaded texture
+		benchmark->filterChain = benchFilter;
+		benchmark->coreId = benchCore;
+		benchmark->coreOptions = std::move(benchCoreOptions);
+		benchmark->moviePath = std::move(benchMovie);
+	}
 }
 
 int RetrogradeGame::initPlugins(IPluginRegistry& registry)
 {
+	if (selfTest) {
+		initSDLSystemPlugin(registry, {});
+		return HalleyAPIFlags::Platform;
+	}
+
+	if (benchmark) {
+		// Headless unless the benchmark needs to upload frames, so it can run on machines without a GPU
+		initSDLSystemPlugin(registry, {});
+		if (benchmark->needsVideo()) {
+			initOpenGLPlugin(registry);
+			return HalleyAPIFlags::Video | HalleyAPIFlags::Platform;
+		}
+		return HalleyAPIFlags::Platform;
+	}
+
 	initOpenGLPlugin(registry);
 	initSDLSystemPlugin(registry, {});
 	//initSDLAudioPlugin(registry);
@@ -77,9 +136,21 @@ std::unique_ptr<Stage> RetrogradeGame::startGame()
 {
 	const bool vsync = true;
 
+	if (selfTest) {
+		return std::make_unique<SelfTestStage>(std::move(selfTest));
+	}
+
 	env = std::make_unique<RetrogradeEnvironment>(*this, getAPI().core->getEnvironment().getProgramPath() / "..", getResources(), getAPI());
 	env->setProfileId("default");
 
+	if (benchmark) {
+		if (benchmark->needsVideo()) {
+			getAPI().video->setWindow(WindowDefinition(WindowType::ResizableWindow, Vector2i(1280, 960), getName() + " Benchmark", true, 0, WindowGLVersion{ 4, 2 }));
+			getAPI().video->setVsync(false);
+		}
+		return std::make_unique<BenchmarkStage>(*env, *benchmark);
+	}
+
 	const auto screenSize = getAPI().system->getScreenSize(0);
 	WindowGLVersion glVersion = { 4, 2 };
 	windowDefinition = WindowDefinition(WindowType::ResizableWindow, Vector2i(1280, 960), getName(), true, 0, glVersion);
@@ -144,4 +215,9 @@ String RetrogradeGame::getDevConAddress() const
 	return devConAddress;
 }
 
+const std::optional<Path>& RetrogradeGame::getTracePath() const
+{
+	return tracePath;
+}
+
 HalleyGame(RetrogradeGame);
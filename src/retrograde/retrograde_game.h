@@ -2,7 +2,9 @@
 
 #include <halley.hpp>
 
+#include "benchmark_stage.h"
 #include "game_stage.h"
+#include "self_test_stage.h"
 #include "src/libretro/libretro_core.h"
 using namespace Halley;
 
@@ -28,6 +30,7 @@ public:
 	void toggleFullscreen();
 
 	String getDevConAddress() const override;
+	const std::optional<Path>& getTracePath() const;
 
 private:
 	const HalleyAPI* api;
@@ -40,4 +43,7 @@ private:
 	WindowDefinition fullscreenDefinition;
 
 	String devConAddress;
+	std::optional<Path> tracePath;
+	std::optional<BenchmarkStage::Config> benchmark;
+	SelfTestStage::Task selfTest;
 };
@@ -0,0 +1,20 @@
+#include "self_test_stage.h"
+
+SelfTestStage::SelfTestStage(Task task)
+	: task(std::move(task))
+{
+}
+
+void SelfTestStage::onVariableUpdate(Time)
+{
+	if (finished) {
+		return;
+	}
+
+	finished = true;
+	getCoreAPI().quit(task());
+}
+
+void SelfTestStage::onRender(RenderContext&) const
+{
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <halley.hpp>
+using namespace Halley;
+
+// Runs a headless check or micro-benchmark on the first update, then quits with its exit code
+class SelfTestStage : public Stage {
+public:
+    using Task = std::function<int()>;
+
+    SelfTestStage(Task task);
+
+    void onVariableUpdate(Time) override;
+    void onRender(RenderContext&) const override;
+
+private:
+    Task task;
+    bool finished = false;
+};
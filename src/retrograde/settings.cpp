@@ -23,6 +23,7 @@ void Settings::load(const ConfigNode& node)
 	romsDir = node["romsDir"].asString("./roms");
 	windowData = node["windowData"].asHashMap<String, ConfigNode>();
 	fullscreen = node["fullscreen"].asBool(true);
+	fastForwardSpeed = node["fastForwardSpeed"].asFloat(0);
 }
 
 ConfigNode Settings::toConfigNode() const
@@ -31,6 +32,7 @@ ConfigNode Settings::toConfigNode() const
 	result["romsDir"] = romsDir.getString();
 	result["windowData"] = windowData;
 	result["fullscreen"] = fullscreen;
+	result["fastForwardSpeed"] = fastForwardSpeed;
 	return result;
 }
 
@@ -58,3 +60,13 @@ void Settings::setFullscreen(bool fs)
 {
 	fullscreen = fs;
 }
+
+float Settings::getFastForwardSpeed() const
+{
+	return fastForwardSpeed;
+}
+
+void Settings::setFastForwardSpeed(float speed)
+{
+	fastForwardSpeed = speed;
+}
@@ -18,12 +18,16 @@ public:
 	bool isFullscreen() const;
 	void setFullscreen(bool fullscreen);
 
+	float getFastForwardSpeed() const;
+	void setFastForwardSpeed(float speed);
+
 private:
 	const Path path;
 
 	Path romsDir;
 	HashMap<String, ConfigNode> windowData;
 	bool fullscreen = true;
+	float fastForwardSpeed = 0;
 
 	void load(const ConfigNode& node);
 	ConfigNode toConfigNode() const;
@@ -0,0 +1,432 @@
+#include "input_movie.h"
+
+namespace {
+	template <typename T>
+	static gsl::span<const gsl::byte> asBytes(const T& v)
+	{
+		return gsl::as_bytes(gsl::span<const T>(&v, 1));
+	}
+
+	template <typename T>
+	static gsl::span<gsl::byte> asWritableBytes(T& v)
+	{
+		return gsl::as_writable_bytes(gsl::span<T>(&v, 1));
+	}
+
+	static uint64_t zigZag(int32_t value)
+	{
+		return static_cast<uint64_t>((static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31));
+	}
+
+	static int32_t unZigZag(uint64_t value)
+	{
+		const auto v = static_cast<uint32_t>(value);
+		return static_cast<int32_t>(v >> 1) ^ -static_cast<int32_t>(v & 1);
+	}
+
+	constexpr uint32_t keyHashSeed = 2166136261u;
+}
+
+InputMovie::InputMovie()
+	: curKeyHash(keyHashSeed)
+{
+}
+
+InputMovie::InputMovie(gsl::span<const gsl::byte> bytes)
+{
+	SerializerOptions options;
+	options.version = 1;
+	Deserializer s(bytes, options);
+
+	s >> *this;
+}
+
+void InputMovie::setStartState(Bytes state)
+{
+	startState = std::move(state);
+}
+
+const Bytes& InputMovie::getStartState() const
+{
+	return startState;
+}
+
+void InputMovie::setCoreId(String coreId)
+{
+	info.coreId = std::move(coreId);
+}
+
+const String& InputMovie::getCoreId() const
+{
+	return info.coreId;
+}
+
+void InputMovie::setGameName(String gameName)
+{
+	info.gameName = std::move(gameName);
+}
+
+const String& InputMovie::getGameName() const
+{
+	return info.gameName;
+}
+
+size_t InputMovie::getFrameCount() const
+{
+	return static_cast<size_t>(info.frameCount);
+}
+
+void InputMovie::recordValue(uint32_t port, uint32_t device, uint32_t index, uint32_t id, int16_t value)
+{
+	curValues.push_back(value);
+	curKeyHash = hashKey(curKeyHash, port, device, index, id);
+}
+
+void InputMovie::endRecordedFrame()
+{
+	encodeFrame();
+	std::swap(prevValues, curValues);
+	prevKeyHash = curKeyHash;
+	curValues.clear();
+	curKeyHash = keyHashSeed;
+	++info.frameCount;
+
+	if (info.frameCount % checkpointInterval == 0) {
+		checkpoints.push_back(Checkpoint{ info.frameCount, frameData.size(), prevKeyHash, prevValues });
+	}
+}
+
+void InputMovie::truncate(size_t frameCount)
+{
+	if (frameCount >= info.frameCount) {
+		return;
+	}
+
+	// Decode forward from the nearest checkpoint, to get back the values the next recorded frame is encoded against
+	while (!checkpoints.empty() && checkpoints.back().frame > frameCount) {
+		checkpoints.pop_back();
+	}
+	uint64_t frame = 0;
+	readPos = 0;
+	prevValues.clear();
+	prevKeyHash = 0;
+	if (!checkpoints.empty()) {
+		const auto& checkpoint = checkpoints.back();
+		frame = checkpoint.frame;
+		readPos = checkpoint.offset;
+		prevValues = checkpoint.values;
+		prevKeyHash = checkpoint.keyHash;
+	}
+	size_t end = readPos;
+	for (; frame < frameCount && decodeFrame(); ++frame) {
+		std::swap(prevValues, curValues);
+		prevKeyHash = curKeyHash;
+		end = readPos;
+	}
+
+	frameData.resize(end);
+	info.frameCount = frame;
+	curValues.clear();
+	curKeyHash = keyHashSeed;
+	readPos = 0;
+}
+
+void InputMovie::resetPlayback()
+{
+	prevValues.clear();
+	curValues.clear();
+	prevKeyHash = 0;
+	curKeyHash = 0;
+	readKeyHash = keyHashSeed;
+	readPos = 0;
+	valuePos = 0;
+	framesPlayed = 0;
+	desynced = false;
+}
+
+bool InputMovie::beginPlaybackFrame()
+{
+	if (framesPlayed >= info.frameCount) {
+		return false;
+	}
+	if (!decodeFrame()) {
+		Logger::logError("Input movie is corrupted at frame " + toString(framesPlayed));
+		desynced = true;
+		return false;
+	}
+	valuePos = 0;
+	readKeyHash = keyHashSeed;
+	return true;
+}
+
+int16_t InputMovie::readValue(uint32_t port, uint32_t device, uint32_t index, uint32_t id)
+{
+	readKeyHash = hashKey(readKeyHash, port, device, index, id);
+	if (valuePos < curValues.size()) {
+		return curValues[valuePos++];
+	}
+
+	// The core is asking for more input than it did when recording, so it's no longer running the same code
+	desynced = true;
+	return 0;
+}
+
+void InputMovie::endPlaybackFrame()
+{
+	// Older movies didn't keep which inputs were read, so only the count can be checked for them
+	if (valuePos != curValues.size() || (version >= 2 && readKeyHash != curKeyHash)) {
+		desynced = true;
+	}
+	std::swap(prevValues, curValues);
+	prevKeyHash = curKeyHash;
+	++framesPlayed;
+}
+
+bool InputMovie::hasPlaybackFramesLeft() const
+{
+	return framesPlayed < info.frameCount;
+}
+
+bool InputMovie::hasDesynced() const
+{
+	return desynced;
+}
+
+Bytes InputMovie::toBytes() const
+{
+	SerializerOptions options;
+	options.version = 1;
+	return Serializer::toBytes(*this, options);
+}
+
+void InputMovie::serialize(Serializer& s) const
+{
+	Header header;
+	memcpy(header.id.data(), "RGMOV", 6);
+	header.version = currentVersion;
+
+	auto compress = [] (const Bytes& bytes)
+	{
+		DataChunk chunk;
+		chunk.origSize = static_cast<uint32_t>(bytes.size());
+		chunk.data = Compression::lz4Compress(bytes.byte_span());
+		return chunk;
+	};
+
+	// Header
+	s << asBytes(header);
+
+	// Info
+	s << ChunkId::Info;
+	s << Serializer::getSize(info);
+	s << info;
+
+	// Start state
+	const auto startStateChunk = compress(startState);
+	s << ChunkId::StartState;
+	s << Serializer::getSize(startStateChunk);
+	s << startStateChunk;
+
+	// Frames, idle stretches compress down to almost nothing
+	const auto framesChunk = compress(frameData);
+	s << ChunkId::Frames;
+	s << Serializer::getSize(framesChunk);
+	s << framesChunk;
+}
+
+void InputMovie::deserialize(Deserializer& s)
+{
+	Header header;
+	s >> asWritableBytes(header);
+	if (memcmp(header.id.data(), "RGMOV", 6) != 0) {
+		throw Exception("Invalid input movie file", 0);
+	}
+	if (header.version > currentVersion) {
+		throw Exception("Don't know how to read input movie version, are you up to date?", 0);
+	}
+	version = header.version;
+
+	auto decompress = [] (const DataChunk& chunk)
+	{
+		Bytes result;
+		result.resize(chunk.origSize);
+		if (const auto nBytes = Compression::lz4Decompress(chunk.data.byte_span(), result.byte_span())) {
+			result.resize(*nBytes);
+			return result;
+		}
+		throw Exception("Failed to decompress input movie", 0);
+	};
+
+	// Read each chunk
+	while (s.getBytesLeft() > 0) {
+		ChunkId id;
+		size_t len;
+		s >> id;
+		s >> len;
+
+		switch (id) {
+		case ChunkId::Info:
+			s >> info;
+			break;
+
+		case ChunkId::StartState:
+			{
+				DataChunk chunk;
+				s >> chunk;
+				startState = decompress(chunk);
+			}
+			break;
+
+		case ChunkId::Frames:
+			{
+				DataChunk chunk;
+				s >> chunk;
+				frameData = decompress(chunk);
+			}
+			break;
+
+		default:
+			s.skipBytes(len);
+			break;
+		}
+	}
+
+	resetPlayback();
+}
+
+void InputMovie::encodeFrame()
+{
+	const size_t n = curValues.size();
+	auto getPrev = [&] (size_t i) -> int16_t
+	{
+		return i < prevValues.size() ? prevValues[i] : 0;
+	};
+
+	size_t nChanges = 0;
+	for (size_t i = 0; i < n; ++i) {
+		if (curValues[i] != getPrev(i)) {
+			++nChanges;
+		}
+	}
+
+	// The low bits flag a change in the number of values read, or in which inputs they came from, both rare
+	const bool sizeChanged = n != prevValues.size();
+	const bool keysChanged = curKeyHash != prevKeyHash;
+	writeVarInt((static_cast<uint64_t>(nChanges) << 2) | (keysChanged ? 2 : 0) | (sizeChanged ? 1 : 0));
+	if (sizeChanged) {
+		writeVarInt(n);
+	}
+	if (keysChanged) {
+		writeVarInt(curKeyHash);
+	}
+
+	size_t next = 0;
+	for (size_t i = 0; i < n; ++i) {
+		if (curValues[i] != getPrev(i)) {
+			writeVarInt(i - next);
+			writeVarInt(zigZag(static_cast<int32_t>(curValues[i]) - getPrev(i)));
+			next = i + 1;
+		}
+	}
+}
+
+bool InputMovie::decodeFrame()
+{
+	const auto header = readVarInt();
+	if (!header) {
+		return false;
+	}
+	const int flagBits = version >= 2 ? 2 : 1;
+	const auto nChanges = *header >> flagBits;
+
+	size_t n = prevValues.size();
+	if (*header & 1) {
+		const auto size = readVarInt();
+		if (!size || *size > maxValuesPerFrame) {
+			return false;
+		}
+		n = static_cast<size_t>(*size);
+	}
+
+	curKeyHash = prevKeyHash;
+	if (flagBits >= 2 && (*header & 2)) {
+		const auto hash = readVarInt();
+		if (!hash) {
+			return false;
+		}
+		curKeyHash = static_cast<uint32_t>(*hash);
+	}
+
+	curValues = prevValues;
+	curValues.resize(n, 0);
+
+	size_t next = 0;
+	for (uint64_t i = 0; i < nChanges; ++i) {
+		const auto gap = readVarInt();
+		const auto diff = readVarInt();
+		if (!gap || !diff || next + *gap >= n) {
+			return false;
+		}
+		const size_t idx = next + static_cast<size_t>(*gap);
+		curValues[idx] = static_cast<int16_t>(curValues[idx] + unZigZag(*diff));
+		next = idx + 1;
+	}
+	return true;
+}
+
+uint32_t InputMovie::hashKey(uint32_t hash, uint32_t port, uint32_t device, uint32_t index, uint32_t id)
+{
+	// FNV-1a over the four fields
+	for (const auto v: { port, device, index, id }) {
+		hash = (hash ^ v) * 16777619u;
+	}
+	return hash;
+}
+
+void InputMovie::writeVarInt(uint64_t value)
+{
+	while (value >= 0x80) {
+		frameData.push_back(static_cast<Byte>(value | 0x80));
+		value >>= 7;
+	}
+	frameData.push_back(static_cast<Byte>(value));
+}
+
+std::optional<uint64_t> InputMovie::readVarInt()
+{
+	uint64_t value = 0;
+	for (int shift = 0; shift < 64 && readPos < frameData.size(); shift += 7) {
+		const auto byte = static_cast<uint8_t>(frameData[readPos++]);
+		value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+		if ((byte & 0x80) == 0) {
+			return value;
+		}
+	}
+	return std::nullopt;
+}
+
+void InputMovie::InfoChunk::serialize(Serializer& s) const
+{
+	s << coreId;
+	s << gameName;
+	s << frameCount;
+}
+
+void InputMovie::InfoChunk::deserialize(Deserializer& s)
+{
+	s >> coreId;
+	s >> gameName;
+	s >> frameCount;
+}
+
+void InputMovie::DataChunk::serialize(Serializer& s) const
+{
+	s << origSize;
+	s << data;
+}
+
+void InputMovie::DataChunk::deserialize(Deserializer& s)
+{
+	s >> origSize;
+	s >> data;
+}
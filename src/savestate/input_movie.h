@@ -0,0 +1,107 @@
+#pragma once
+
+#include <halley.hpp>
+using namespace Halley;
+
+// A recording of every value the core read from onInputState(), frame by frame, starting from a save state.
+// Feeding the same values back from the same state replays the session exactly, on any build of the frontend.
+// Each frame also keeps a hash of which inputs were read, so playback can tell when the core starts asking for different ones.
+class InputMovie {
+public:
+	InputMovie();
+	InputMovie(gsl::span<const gsl::byte> bytes);
+
+	void setStartState(Bytes state);
+	const Bytes& getStartState() const;
+
+	void setCoreId(String coreId);
+	const String& getCoreId() const;
+	void setGameName(String gameName);
+	const String& getGameName() const;
+
+	size_t getFrameCount() const;
+
+	// Recording, truncate() drops every frame from frameCount on, so recording can carry on from an earlier point
+	void recordValue(uint32_t port, uint32_t device, uint32_t index, uint32_t id, int16_t value);
+	void endRecordedFrame();
+	void truncate(size_t frameCount);
+
+	// Playback, beginPlaybackFrame() returns false once every frame has been played
+	void resetPlayback();
+	bool beginPlaybackFrame();
+	int16_t readValue(uint32_t port, uint32_t device, uint32_t index, uint32_t id);
+	void endPlaybackFrame();
+	bool hasPlaybackFramesLeft() const;
+	bool hasDesynced() const;
+
+	Bytes toBytes() const;
+
+	void serialize(Serializer& s) const;
+	void deserialize(Deserializer& s);
+
+private:
+	struct Header {
+		std::array<char, 6> id;
+		uint16_t version;
+	};
+
+	enum class ChunkId : uint8_t {
+		Info,
+		StartState,
+		Frames
+	};
+
+	struct InfoChunk {
+		String coreId;
+		String gameName;
+		uint64_t frameCount = 0;
+
+		void serialize(Serializer& s) const;
+		void deserialize(Deserializer& s);
+	};
+
+	struct DataChunk {
+		uint32_t origSize = 0;
+		Bytes data;
+
+		void serialize(Serializer& s) const;
+		void deserialize(Deserializer& s);
+	};
+
+	// Where decoding can resume from without replaying the whole movie
+	struct Checkpoint {
+		uint64_t frame = 0;
+		size_t offset = 0;
+		uint32_t keyHash = 0;
+		Vector<int16_t> values;
+	};
+
+	InfoChunk info;
+	Bytes startState;
+
+	// Each frame is encoded against the previous one, as the count of changed values followed by
+	// (gap since the last change, difference) pairs, all varints. An idle frame costs a single byte.
+	// From version 2, the hash of the inputs read follows the count whenever it differs from the previous frame's.
+	constexpr static uint16_t currentVersion = 2;
+	constexpr static size_t maxValuesPerFrame = 65536; // Far more than any core reads, so a corrupt count can't allocate unbounded memory
+	constexpr static uint64_t checkpointInterval = 600;
+
+	uint16_t version = currentVersion;
+	Bytes frameData;
+	Vector<int16_t> prevValues;
+	Vector<int16_t> curValues;
+	uint32_t prevKeyHash = 0;
+	uint32_t curKeyHash = 0;
+	uint32_t readKeyHash = 0;
+	Vector<Checkpoint> checkpoints;
+	size_t readPos = 0;
+	size_t valuePos = 0;
+	uint64_t framesPlayed = 0;
+	bool desynced = false;
+
+	void encodeFrame();
+	bool decodeFrame();
+	static uint32_t hashKey(uint32_t hash, uint32_t port, uint32_t device, uint32_t index, uint32_t id);
+	void writeVarInt(uint64_t value);
+	std::optional<uint64_t> readVarInt();
+};
@@ -1,98 +1,696 @@
 #include "rewind_data.h"
 
-RewindData::RewindData(size_t bytes)
-	: capacity(bytes)
+#include "src/util/frame_diff.h"
+#include "src/util/frame_trace.h"
+#include "src/util/worker_thread.h"
+
+RewindData::RewindData(size_t bytes, bool hugePages, size_t maxFramesInFlight)
+	: hugePages(hugePages)
+	, maxFramesInFlight(std::max(maxFramesInFlight, static_cast<size_t>(1)))
+{
+	// Every frame for the last few seconds, every 4th for the next minute, then one per second
+	setTiers({ Tier{ 5.0, 1 }, Tier{ 65.0, 4 }, Tier{ 0.0, 60 } });
+	arena = std::make_unique<RingArena>(bytes, hugePages);
+	compressWorker = std::make_unique<WorkerThread>("rewind_compress");
+}
+
+RewindData::~RewindData()
 {
+	compressWorker.reset();
 }
 
 void RewindData::setCapacity(size_t bytes)
 {
-	capacity = bytes;
+	compressWorker->wait();
+
+	std::unique_lock<std::mutex> lock(mutex);
+	while (!frames.empty()) {
+		dropOldest();
+	}
+	arena = std::make_unique<RingArena>(bytes, hugePages);
 }
 
-void RewindData::pushFrame(Bytes saveState)
+void RewindData::setFrameRate(double fps)
 {
-	frames.push_back(std::move(saveState));
-	if (frames.size() >= 2) {
-		compress(frames[frames.size() - 2], frames.back());
+	if (fps > 0 && fps != frameRate) {
+		frameRate = fps;
+		updateTierAges();
 	}
+}
 
-	while (frames.size() > 2 && curSize > capacity) {
-		dropOldest();
+void RewindData::setTiers(Vector<Tier> tiers)
+{
+	assert(!tiers.empty());
+	this->tiers = std::move(tiers);
+	updateTierAges();
+}
+
+void RewindData::pushFrame(Bytes saveState, std::shared_ptr<const Image> thumbnail, uint64_t tag)
+{
+	if (compressWorker->getPendingJobs() >= maxFramesInFlight) {
+		// Back-pressure: the worker is falling behind, so wait for it rather than queueing unbounded snapshots
+		TraceScope trace("rewind_wait");
+		compressWorker->wait(maxFramesInFlight - 1);
+	}
+
+	std::unique_lock<std::mutex> lock(mutex);
+	dropLostFrames();
+
+	const bool keyframe = isKeyframeDue();
+	frames.push_back(makeFrame(std::move(saveState), nextFrameNumber++, tag, keyframe));
+	if (keyframe) {
+		frames.back()->thumbnail = std::move(thumbnail);
 	}
 	if (frames.size() >= 2) {
-		//Logger::logDev("Rewind buffer = " + toString(frames.size()) + " frames [+" + toString(frames[frames.size() - 2].size()) + " bytes]");
+		// Jobs run in order, so the previous frame's own compression (which reads this one) is already queued ahead
+		auto oldFrame = frames[frames.size() - 2];
+		auto newFrame = frames.back();
+		++oldFrame->pendingJobs;
+		++newFrame->pendingJobs;
+		compressWorker->post([=] ()
+		{
+			compress(*oldFrame, *newFrame);
+			--oldFrame->pendingJobs;
+			--newFrame->pendingJobs;
+		});
 	}
+
+	thin();
 }
 
-std::optional<Bytes> RewindData::popFrame()
+std::optional<RewindData::Snapshot> RewindData::popFrame()
 {
+	// Any frame still in flight has to be fully compressed before it can be restored
+	compressWorker->wait();
+
+	std::unique_lock<std::mutex> lock(mutex);
+	dropLostFrames();
+	return doPopFrame();
+}
+
+std::optional<RewindData::Snapshot> RewindData::seek(uint64_t frameNumber)
+{
+	compressWorker->wait();
+
+	std::unique_lock<std::mutex> lock(mutex);
+	dropLostFrames();
 	if (frames.empty()) {
 		return {};
 	}
-	if (frames.size() >= 2) {
-		decompress(frames[frames.size() - 2], frames.back());
+
+	// Frames are sorted by number, so find the newest one that isn't past the target
+	const auto iter = std::upper_bound(frames.begin(), frames.end(), frameNumber, [] (uint64_t n, const std::shared_ptr<Frame>& frame) { return n < frame->frameNumber; });
+	if (iter == frames.begin()) {
+		// The target has already been evicted, and restoring a newer frame instead would jump the wrong way
+		return {};
 	}
-	auto bytes = std::move(frames.back());
-	frames.pop_back();
-	return bytes;
+	const size_t idx = static_cast<size_t>(iter - frames.begin()) - 1;
+
+	auto state = getBuffer(0);
+	reconstruct(idx, state);
+
+	// Drop everything newer, then make the target the raw newest frame and pop it as usual
+	while (frames.size() > idx + 1) {
+		auto frame = std::move(frames.back());
+		frames.pop_back();
+		releaseFrame(std::move(frame));
+	}
+	auto& target = *frames.back();
+	if (target.storage) {
+		arena->free(*target.storage);
+		target.storage.reset();
+	} else {
+		returnBuffer(std::move(target.data));
+	}
+	target.data = std::move(state);
+	target.bitmapSize = 0;
+	target.compressed = false;
+
+	return doPopFrame();
+}
+
+bool RewindData::isKeyframeDue() const
+{
+	return nextFrameNumber % keyframeInterval == 0;
+}
+
+Vector<RewindData::Keyframe> RewindData::getKeyframes() const
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	Vector<Keyframe> result;
+	const auto newest = frames.empty() ? 0 : frames.back()->frameNumber;
+
+	// A lost frame takes everything older with it on the next push or seek, so none of those can be offered
+	size_t first = 0;
+	for (size_t i = 0; i < frames.size(); ++i) {
+		if (frames[i]->lost) {
+			first = i + 1;
+		}
+	}
+
+	for (size_t i = first; i < frames.size(); ++i) {
+		const auto& frame = frames[i];
+		if (frame->keyframe) {
+			result.push_back(Keyframe{ frame->frameNumber, static_cast<Time>(newest - frame->frameNumber) / frameRate, frame->thumbnail });
+		}
+	}
+	return result;
+}
+
+std::optional<uint64_t> RewindData::getNewestFrameNumber() const
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	if (frames.empty()) {
+		return {};
+	}
+	return frames.back()->frameNumber;
 }
 
 Bytes RewindData::getBuffer(size_t size)
 {
 	Bytes buffer;
-	if (!spareBuffers.empty()) {
-		buffer = std::move(spareBuffers.back());
-		spareBuffers.pop_back();
+	{
+		std::unique_lock<std::mutex> lock(spareBuffersMutex);
+		if (!spareBuffers.empty()) {
+			buffer = std::move(spareBuffers.back());
+			spareBuffers.pop_back();
+		}
 	}
 	buffer.resize(size);
 	return buffer;
 }
 
-void RewindData::compress(Bytes& oldFrame, const Bytes& newFrame)
+void RewindData::returnBuffer(Bytes buffer)
 {
-	// Delta compress
-	assert(oldFrame.size() == newFrame.size());
-	size_t n = oldFrame.size();
-	auto* oldData = oldFrame.data();
-	const auto* newData = newFrame.data();
-	for (size_t i = 0; i < n; ++i) {
-		oldData[i] -= newData[i];
+	std::unique_lock<std::mutex> lock(spareBuffersMutex);
+	spareBuffers.push_back(std::move(buffer));
+}
+
+std::optional<RewindData::Snapshot> RewindData::doPopFrame()
+{
+	if (frames.empty()) {
+		return {};
 	}
 
-	// Deflate
-	compressBuffer.resize(std::max(compressBuffer.size(), oldFrame.size() + 16));
-	const auto size = Compression::lz4Compress(oldFrame, compressBuffer);
-	spareBuffers.push_back(std::move(oldFrame));
-	oldFrame = Bytes();
-	oldFrame.resize(size);
-	memcpy(oldFrame.data(), compressBuffer.data(), size);
+	if (frames.size() >= 2) {
+		decompress(*frames[frames.size() - 2], *frames.back());
+	}
+	nextFrameNumber = frames.back()->frameNumber;
+	auto snapshot = Snapshot{ std::move(frames.back()->data), frames.back()->tag };
+	auto frame = std::move(frames.back());
+	frames.pop_back();
+	releaseFrame(std::move(frame));
+	return snapshot;
+}
+
+void RewindData::compress(Frame& oldFrame, const Frame& newFrame)
+{
+	TraceScope trace("rewind_compress");
 
-	curSize += size;
+	if (oldFrame.keyframe || !storeDelta(oldFrame, oldFrame.data, newFrame.data)) {
+		// Keyframes and resized states stand alone, so they're stored whole
+		oldFrame.rawSize = oldFrame.data.size();
+		oldFrame.standalone = true;
+		store(oldFrame, {}, oldFrame.data);
+	}
+
+	returnBuffer(std::move(oldFrame.data));
+	oldFrame.data = Bytes();
 }
 
-void RewindData::decompress(Bytes& oldFrame, const Bytes& newFrame)
+bool RewindData::storeDelta(Frame& oldFrame, gsl::span<const Byte> oldState, gsl::span<const Byte> newState)
 {
-	curSize -= oldFrame.size();
+	const size_t n = oldState.size();
+	const size_t newSize = newState.size();
+	const size_t nBlocks = (n + blockSize - 1) / blockSize;
+	const auto* oldData = reinterpret_cast<const gsl::byte*>(oldState.data());
+	const auto* newData = reinterpret_cast<const gsl::byte*>(newState.data());
 
-	// Inflate
-	auto size = Compression::lz4Decompress(oldFrame, compressBuffer);
-	oldFrame = getBuffer(*size);
-	memcpy(oldFrame.data(), compressBuffer.data(), *size);
+	// Gather the XOR delta of every block that changed. The newer frame counts as zero-padded past its end,
+	// so blocks it doesn't fully cover are always dirty and their tail is stored verbatim.
+	bitmapBuffer.clear();
+	bitmapBuffer.resize((nBlocks + 7) / 8, 0);
+	deltaBuffer.resize(std::max(deltaBuffer.size(), n));
+	auto* delta = reinterpret_cast<gsl::byte*>(deltaBuffer.data());
+	size_t deltaSize = 0;
+	for (size_t block = 0; block < nBlocks; ++block) {
+		const size_t offset = block * blockSize;
+		const size_t len = std::min(blockSize, n - offset);
+		const size_t overlap = offset < newSize ? std::min(len, newSize - offset) : 0;
+		if (overlap == len && FrameDiff::rowsEqual(oldData + offset, newData + offset, len)) {
+			continue;
+		}
+		bitmapBuffer[block / 8] |= static_cast<uint8_t>(1 << (block % 8));
+		FrameDiff::xorBytes(oldData + offset, newData + offset, delta + deltaSize, overlap);
+		memcpy(delta + deltaSize + overlap, oldData + offset + overlap, len - overlap);
+		deltaSize += len;
+	}
 
-	// Delta decompress
-	assert(oldFrame.size() == newFrame.size());
-	size_t n = oldFrame.size();
-	auto* oldData = oldFrame.data();
-	const auto* newData = newFrame.data();
+	// When the state was resized, its layout has usually shifted too, and a delta that touches most blocks buys nothing over storing it whole
+	if (n != newSize && deltaSize > n / 2) {
+		return false;
+	}
+	oldFrame.rawSize = n;
+	store(oldFrame, bitmapBuffer, gsl::span<const Byte>(deltaBuffer.data(), deltaSize));
+	return true;
+}
+
+void RewindData::decompress(Frame& oldFrame, const Frame& newFrame)
+{
+	// Start from the newer frame, then only the dirty blocks need patching
+	auto result = getBuffer(oldFrame.rawSize);
+	if (!oldFrame.standalone) {
+		const size_t overlap = std::min(result.size(), newFrame.data.size());
+		memcpy(result.data(), newFrame.data.data(), overlap);
+		memset(result.data() + overlap, 0, result.size() - overlap);
+	}
+	applyDelta(oldFrame, result);
+
+	if (oldFrame.storage) {
+		arena->free(*oldFrame.storage);
+		oldFrame.storage.reset();
+	}
+	oldFrame.data = std::move(result);
+	oldFrame.bitmapSize = 0;
+	oldFrame.standalone = false;
+	oldFrame.compressed = false;
+}
+
+void RewindData::merge(Frame& olderFrame, Frame& droppedFrame)
+{
+	TraceScope trace("rewind_merge");
+
+	// Both frames are pinned by this job, so their stored bytes can be read without holding the lock
+	gsl::span<const Byte> olderStored;
+	gsl::span<const Byte> droppedStored;
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		if (olderFrame.lost || droppedFrame.lost) {
+			if (olderFrame.storage) {
+				arena->free(*olderFrame.storage);
+				olderFrame.storage.reset();
+			}
+			if (droppedFrame.storage) {
+				arena->free(*droppedFrame.storage);
+				droppedFrame.storage.reset();
+			}
+			olderFrame.lost = true;
+			return;
+		}
+		olderStored = getStored(olderFrame);
+		droppedStored = getStored(droppedFrame);
+	}
+
+	// olderFrame ^ droppedFrame ^ next = olderFrame's delta against next, so the two deltas just get XORed together.
+	// thin() only merges frames of the same size, the zero-padded tail blocks of a resized state would otherwise misalign.
+	assert(olderFrame.rawSize == droppedFrame.rawSize);
+	const size_t n = olderFrame.rawSize;
+	const size_t nBlocks = (n + blockSize - 1) / blockSize;
+
+	inflate(olderFrame, olderStored, decompressBuffer);
+	inflate(droppedFrame, droppedStored, mergeBuffer);
+	const auto olderBitmap = olderStored.subspan(0, olderFrame.bitmapSize);
+	const auto droppedBitmap = droppedStored.subspan(0, droppedFrame.bitmapSize);
+	const auto* olderDelta = reinterpret_cast<const gsl::byte*>(decompressBuffer.data());
+	const auto* droppedDelta = reinterpret_cast<const gsl::byte*>(mergeBuffer.data());
+
+	bitmapBuffer.clear();
+	bitmapBuffer.resize((nBlocks + 7) / 8, 0);
+	deltaBuffer.resize(std::max(deltaBuffer.size(), n));
+	auto* delta = reinterpret_cast<gsl::byte*>(deltaBuffer.data());
+	size_t olderPos = 0;
+	size_t droppedPos = 0;
+	size_t deltaSize = 0;
+	for (size_t block = 0; block < nBlocks; ++block) {
+		const size_t len = std::min(blockSize, n - block * blockSize);
+		const bool olderDirty = isBlockDirty(olderBitmap, block);
+		const bool droppedDirty = isBlockDirty(droppedBitmap, block);
+
+		bool dirty = false;
+		if (olderDirty && droppedDirty) {
+			// A block that changed and then changed back is clean again
+			dirty = !FrameDiff::rowsEqual(olderDelta + olderPos, droppedDelta + droppedPos, len);
+			if (dirty) {
+				FrameDiff::xorBytes(olderDelta + olderPos, droppedDelta + droppedPos, delta + deltaSize, len);
+			}
+		} else if (olderDirty || droppedDirty) {
+			dirty = true;
+			memcpy(delta + deltaSize, olderDirty ? olderDelta + olderPos : droppedDelta + droppedPos, len);
+		}
+
+		if (dirty) {
+			bitmapBuffer[block / 8] |= static_cast<uint8_t>(1 << (block % 8));
+			deltaSize += len;
+		}
+		olderPos += olderDirty ? len : 0;
+		droppedPos += droppedDirty ? len : 0;
+	}
+
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		arena->free(*droppedFrame.storage);
+		droppedFrame.storage.reset();
+	}
+	store(olderFrame, bitmapBuffer, gsl::span<const Byte>(deltaBuffer.data(), deltaSize));
+}
+
+void RewindData::demote(Frame& keyframe, const Vector<std::shared_ptr<Frame>>& newer)
+{
+	TraceScope trace("rewind_demote");
+
+	// Everything involved is pinned by this job, so only looking up their stored bytes needs the lock
+	gsl::span<const Byte> keyframeStored;
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		keyframeStored = getStored(keyframe);
+		chainStored.clear();
+		for (const auto& frame: newer) {
+			chainStored.push_back(getStored(*frame));
+		}
+	}
+
+	// Rebuild the newer neighbour from the next standalone frame, then re-encode the keyframe as a delta against it
+	auto newerState = getBuffer(0);
+	for (size_t i = newer.size(); i > 0; --i) {
+		applyDelta(*newer[i - 1], chainStored[i - 1], newerState);
+	}
+	auto state = getBuffer(0);
+	applyDelta(keyframe, keyframeStored, state);
+
+	keyframe.standalone = !storeDelta(keyframe, state, newerState);
+
+	returnBuffer(std::move(state));
+	returnBuffer(std::move(newerState));
+}
+
+void RewindData::reconstruct(size_t idx, Bytes& dst)
+{
+	// Walk forward to the nearest standalone frame (or the raw newest frame), then apply deltas back down to idx
+	size_t baseIdx = idx;
+	while (baseIdx + 1 < frames.size() && !(frames[baseIdx]->standalone && frames[baseIdx]->compressed)) {
+		++baseIdx;
+	}
+
+	const auto& base = *frames[baseIdx];
+	if (base.compressed) {
+		dst.resize(base.rawSize);
+		applyDelta(base, dst);
+	} else {
+		dst.resize(base.data.size());
+		memcpy(dst.data(), base.data.data(), dst.size());
+	}
+
+	for (size_t i = baseIdx; i > idx; --i) {
+		applyDelta(*frames[i - 1], dst);
+	}
+}
+
+void RewindData::applyDelta(const Frame& frame, Bytes& dst)
+{
+	applyDelta(frame, getStored(frame), dst);
+}
+
+void RewindData::applyDelta(const Frame& frame, gsl::span<const Byte> stored, Bytes& dst)
+{
+	if (frame.standalone) {
+		dst.resize(frame.rawSize);
+		inflate(frame, stored, dst);
+		return;
+	}
+
+	// The state may have been resized since, growing zero-pads just like the delta assumed
+	dst.resize(frame.rawSize);
+	const auto deltaSize = inflate(frame, stored, decompressBuffer);
+	if (deltaSize == 0) {
+		return;
+	}
+
+	// Undo the XOR delta
+	const size_t n = frame.rawSize;
+	const auto bitmap = stored.subspan(0, frame.bitmapSize);
+	const auto* delta = reinterpret_cast<const gsl::byte*>(decompressBuffer.data());
+	auto* data = reinterpret_cast<gsl::byte*>(dst.data());
+	const size_t nBlocks = (n + blockSize - 1) / blockSize;
+	size_t deltaPos = 0;
+	for (size_t block = 0; block < nBlocks; ++block) {
+		if (isBlockDirty(bitmap, block)) {
+			const size_t offset = block * blockSize;
+			const size_t len = std::min(blockSize, n - offset);
+			FrameDiff::xorBytes(data + offset, delta + deltaPos, data + offset, len);
+			deltaPos += len;
+		}
+	}
+	assert(deltaPos == deltaSize);
+}
+
+size_t RewindData::inflate(const Frame& frame, gsl::span<const Byte> stored, Bytes& dst)
+{
+	const auto payload = stored.subspan(frame.bitmapSize);
+	if (payload.empty()) {
+		return 0;
+	}
+
+	dst.resize(std::max(dst.size(), frame.rawSize));
+	const auto size = Compression::lz4Decompress(payload, gsl::span<Byte>(dst));
+	assert(size);
+	return size.value_or(0);
+}
+
+void RewindData::store(Frame& frame, gsl::span<const uint8_t> bitmap, gsl::span<const Byte> delta)
+{
+	// Deflate into scratch first, since the final size isn't known until LZ4 is done
+	size_t payloadSize = 0;
+	if (!delta.empty()) {
+		compressBuffer.resize(std::max(compressBuffer.size(), delta.size() + delta.size() / 255 + 16));
+		payloadSize = Compression::lz4Compress(delta, gsl::span<Byte>(compressBuffer));
+	}
+
+	std::unique_lock<std::mutex> lock(mutex);
+	if (frame.storage) {
+		arena->free(*frame.storage);
+		frame.storage.reset();
+	}
+
+	// Thinning leaves holes that the arena only reclaims once everything older is freed too, so while it fills up,
+	// keep moving the oldest live allocations up to the head. That needs some room left, hence starting well before it's full.
+	for (int i = 0; i < maxRelocationsPerStore && arena->getUsed() > arena->getCapacity() / 4 * 3 && relocateOldest(); ++i) {
+	}
+
+	// Make room by evicting the oldest history, frames still referenced by a job stay put
+	auto handle = arena->allocate(bitmap.size() + payloadSize);
+	while (!handle && frames.size() > 2 && frames.front()->isSettled()) {
+		dropOldest();
+		handle = arena->allocate(bitmap.size() + payloadSize);
+	}
+
+	if (handle) {
+		auto dst = arena->get(*handle);
+		if (!bitmap.empty()) {
+			memcpy(dst.data(), bitmap.data(), bitmap.size());
+		}
+		if (payloadSize > 0) {
+			memcpy(dst.data() + bitmap.size(), compressBuffer.data(), payloadSize);
+		}
+		frame.storage = handle;
+		frame.bitmapSize = bitmap.size();
+	} else {
+		// Not even the newest history fits, this frame (and everything older, which depends on it) is gone
+		frame.lost = true;
+	}
+	frame.compressed = true;
+}
+
+bool RewindData::relocateOldest()
+{
+	// Handles are handed out in order, so the smallest one is the allocation pinning the arena's tail
+	Frame* oldest = nullptr;
+	for (const auto& frame: frames) {
+		if (frame->storage && (!oldest || *frame->storage < *oldest->storage)) {
+			oldest = frame.get();
+		}
+	}
+	if (!oldest || !oldest->isSettled()) {
+		return false;
+	}
+
+	const auto src = arena->get(*oldest->storage);
+	const auto handle = arena->allocate(src.size());
+	if (!handle) {
+		return false;
+	}
+	memcpy(arena->get(*handle).data(), src.data(), src.size());
+	arena->free(*oldest->storage);
+	oldest->storage = handle;
+	return true;
+}
+
+gsl::span<const Byte> RewindData::getStored(const Frame& frame) const
+{
+	if (!frame.storage) {
+		return {};
+	}
+	return arena->get(*frame.storage);
+}
+
+bool RewindData::isBlockDirty(gsl::span<const Byte> bitmap, size_t block)
+{
+	return (bitmap[block / 8] & (1 << (block % 8))) != 0;
+}
+
+std::shared_ptr<RewindData::Frame> RewindData::makeFrame(Bytes data, uint64_t frameNumber, uint64_t tag, bool keyframe)
+{
+	std::shared_ptr<Frame> frame;
+	if (spareFrames.empty()) {
+		frame = std::make_shared<Frame>();
+	} else {
+		frame = std::move(spareFrames.back());
+		spareFrames.pop_back();
+	}
+
+	frame->data = std::move(data);
+	frame->storage.reset();
+	frame->bitmapSize = 0;
+	frame->rawSize = 0;
+	frame->frameNumber = frameNumber;
+	frame->tag = tag;
+	frame->keyframe = keyframe;
+	frame->standalone = false;
+	frame->compressed = false;
+	frame->lost = false;
+	frame->pendingJobs = 0;
+	frame->thumbnail.reset();
+	return frame;
+}
+
+void RewindData::thin()
+{
+	// The two newest frames are still raw or being compressed, so they're never candidates
+	const uint64_t newest = frames.empty() ? 0 : frames.back()->frameNumber;
+	for (size_t i = 0; i + 2 < frames.size(); ) {
+		const auto frame = frames[i];
+		const int stride = getStride(newest - frame->frameNumber);
+		if (frame->keyframe && frame->isSettled() && frame->standalone && frame->frameNumber % getKeyframeSpacing(stride) != 0) {
+			// Older tiers keep far fewer frames, so most of their keyframes get re-encoded as deltas against the newer neighbour.
+			// That needs the whole chain up to the next standalone frame, all of it settled so it can be pinned while the worker walks it.
+			size_t baseIdx = i + 1;
+			while (baseIdx + 2 < frames.size() && frames[baseIdx]->isSettled() && !frames[baseIdx]->lost && !frames[baseIdx]->standalone) {
+				++baseIdx;
+			}
+			if (baseIdx + 2 < frames.size() && frames[baseIdx]->isSettled() && !frames[baseIdx]->lost && !frame->lost) {
+				Vector<std::shared_ptr<Frame>> newer(frames.begin() + i + 1, frames.begin() + baseIdx + 1);
+				frame->keyframe = false;
+				frame->thumbnail.reset();
+				++frame->pendingJobs;
+				for (const auto& f: newer) {
+					++f->pendingJobs;
+				}
+				compressWorker->post([=] ()
+				{
+					demote(*frame, newer);
+					--frame->pendingJobs;
+					for (const auto& f: newer) {
+						--f->pendingJobs;
+					}
+				});
+			}
+		}
+		if (stride > 1 && frame->frameNumber % stride != 0 && frame->isSettled() && !frame->standalone) {
+			if (i == 0) {
+				dropOldest();
+				continue;
+			}
+
+			auto olderFrame = frames[i - 1];
+			if (olderFrame->isSettled() && olderFrame->standalone) {
+				// Standalone frames don't depend on their newer neighbour, so there's nothing to fold in
+				frames.erase(frames.begin() + i);
+				releaseFrame(frame);
+				continue;
+			} else if (olderFrame->isSettled() && olderFrame->rawSize == frame->rawSize) {
+				auto droppedFrame = frame;
+				++olderFrame->pendingJobs;
+				++droppedFrame->pendingJobs;
+				frames.erase(frames.begin() + i);
+				compressWorker->post([=] ()
+				{
+					merge(*olderFrame, *droppedFrame);
+					--olderFrame->pendingJobs;
+					--droppedFrame->pendingJobs;
+				});
+				continue;
+			}
+		}
+		++i;
+	}
+}
+
+void RewindData::dropLostFrames()
+{
+	// A frame that couldn't be stored breaks the chain, so it goes along with everything older
+	size_t n = 0;
+	for (size_t i = 0; i < frames.size(); ++i) {
+		if (frames[i]->pendingJobs > 0) {
+			break;
+		}
+		if (frames[i]->lost) {
+			n = i + 1;
+		}
+	}
 	for (size_t i = 0; i < n; ++i) {
-		oldData[i] += newData[i];
+		dropOldest();
 	}
+}
 
+int RewindData::getStride(uint64_t age) const
+{
+	for (size_t i = 0; i + 1 < tiers.size(); ++i) {
+		if (age < tierMaxAges[i]) {
+			return tiers[i].stride;
+		}
+	}
+	return tiers.back().stride;
+}
+
+uint64_t RewindData::getKeyframeSpacing(int stride) const
+{
+	// Aim for the same number of kept frames between keyframes in every tier, rounded so the survivors are still keyframeInterval aligned
+	const uint64_t spacing = static_cast<uint64_t>(stride) * keptFramesPerKeyframe;
+	return std::max(keyframeInterval, (spacing + keyframeInterval - 1) / keyframeInterval * keyframeInterval);
+}
+
+void RewindData::updateTierAges()
+{
+	tierMaxAges.clear();
+	for (const auto& tier: tiers) {
+		tierMaxAges.push_back(static_cast<uint64_t>(tier.maxAge * frameRate));
+	}
 }
 
 void RewindData::dropOldest()
 {
-	curSize -= frames.front().size();
+	auto frame = std::move(frames.front());
 	frames.pop_front();
+	releaseFrame(std::move(frame));
+}
+
+void RewindData::releaseFrame(std::shared_ptr<Frame> frame)
+{
+	if (frame->storage) {
+		arena->free(*frame->storage);
+		frame->storage.reset();
+	}
+	if (!frame->data.empty()) {
+		returnBuffer(std::move(frame->data));
+	}
+	frame->thumbnail.reset();
+
+	// Frames still held by a queued job are left to die with it
+	if (frame.use_count() == 1) {
+		spareFrames.push_back(std::move(frame));
+	}
+}
+
+bool RewindData::Frame::isSettled() const
+{
+	return pendingJobs.load(std::memory_order_acquire) == 0 && compressed;
 }
@@ -1,26 +1,131 @@
 #pragma once
 
 #include <halley.hpp>
+#include "src/util/ring_arena.h"
 using namespace Halley;
 
+class WorkerThread;
+
 class RewindData {
 public:
-	explicit RewindData(size_t bytes);
+    // Snapshots younger than maxAge are kept one every stride frames. The last tier's maxAge is ignored, it covers everything older.
+    // Each stride should be a multiple of the previous tier's, so frames kept by one tier line up with the next.
+    struct Tier {
+        Time maxAge;
+        int stride;
+    };
+
+    struct Keyframe {
+        uint64_t frameNumber;
+        Time age;
+        std::shared_ptr<const Image> thumbnail;
+    };
+
+    // A restored save state, along with the tag it was pushed with
+    struct Snapshot {
+        Bytes state;
+        uint64_t tag = 0;
+    };
+
+	explicit RewindData(size_t bytes, bool hugePages = false, size_t maxFramesInFlight = 3);
+    ~RewindData();
+
     void setCapacity(size_t bytes);
+    void setFrameRate(double fps);
+    void setTiers(Vector<Tier> tiers);
+
+    void pushFrame(Bytes saveState, std::shared_ptr<const Image> thumbnail = {}, uint64_t tag = 0);
+    std::optional<Snapshot> popFrame();
 
-    void pushFrame(Bytes saveState);
-    std::optional<Bytes> popFrame();
+    // Restores the newest kept frame at or before frameNumber, discarding everything after it, like popping down to it
+    std::optional<Snapshot> seek(uint64_t frameNumber);
+
+    bool isKeyframeDue() const;
+    Vector<Keyframe> getKeyframes() const;
+    std::optional<uint64_t> getNewestFrameNumber() const;
 
     Bytes getBuffer(size_t size);
 
 private:
-    std::deque<Bytes> frames;
+    // Compressed frames only store the 4 KB blocks that differ from the next (newer) frame, XORed against it and LZ4 compressed.
+    // Clean blocks are shared with the newer frame by reference, so a frame identical to its successor costs just its bitmap.
+    // Since the deltas are XORs, a frame can be dropped from the middle of the chain by folding its delta into the older neighbour's.
+    // Keyframes store their whole state instead, so any frame can be rebuilt by walking back from the nearest newer keyframe.
+    // Once they age into a tier with a wider stride, most keyframes are re-encoded as deltas, keeping the chains about as long as in newer tiers.
+    // Some cores resize their state at runtime: the newer frame then reads as zero-padded (or truncated) to the older one's size,
+    // and when that leaves most blocks dirty, the frame is stored whole like a keyframe.
+    // The newest frame is kept raw, every other frame lives in the arena as [dirty block bitmap][LZ4 payload].
+    struct Frame {
+        Bytes data;
+        std::optional<RingArena::Handle> storage;
+        size_t bitmapSize = 0;
+        size_t rawSize = 0;
+        uint64_t frameNumber = 0;
+        uint64_t tag = 0;
+        bool keyframe = false;
+        bool standalone = false;
+        bool compressed = false;
+        bool lost = false;
+        std::atomic<int> pendingJobs = 0;
+        std::shared_ptr<const Image> thumbnail;
+
+        bool isSettled() const;
+    };
+
+    constexpr static size_t blockSize = 4096;
+    constexpr static uint64_t keyframeInterval = 240; // A multiple of every tier stride, so thinning never lands on a keyframe
+    constexpr static uint64_t keptFramesPerKeyframe = 60;
+    constexpr static int maxRelocationsPerStore = 8;
+
+    // Guards frames and the arena, which the worker touches when storing frames and evicting old ones to make room
+    mutable std::mutex mutex;
+    std::deque<std::shared_ptr<Frame>> frames;
+    std::unique_ptr<RingArena> arena;
+    Vector<std::shared_ptr<Frame>> spareFrames;
+    bool hugePages = false;
+    size_t maxFramesInFlight = 0;
+    uint64_t nextFrameNumber = 0;
+
+    double frameRate = 60.0;
+    Vector<Tier> tiers;
+    Vector<uint64_t> tierMaxAges;
+
+    std::mutex spareBuffersMutex;
     Vector<Bytes> spareBuffers;
+
+    // Scratch space for the worker, reused rather than reallocated for every frame
+    Bytes deltaBuffer;
+    Vector<uint8_t> bitmapBuffer;
     Bytes compressBuffer;
-    size_t capacity = 0;
-    size_t curSize = 0;
+    Bytes decompressBuffer;
+    Bytes mergeBuffer;
+    Vector<gsl::span<const Byte>> chainStored;
+
+    // Declared last so it's joined before anything its jobs touch is destroyed
+    std::unique_ptr<WorkerThread> compressWorker;
+
+    void compress(Frame& oldFrame, const Frame& newFrame);
+    void decompress(Frame& oldFrame, const Frame& newFrame);
+    void merge(Frame& olderFrame, Frame& droppedFrame);
+    void demote(Frame& keyframe, const Vector<std::shared_ptr<Frame>>& newer);
+    void reconstruct(size_t idx, Bytes& dst);
+    void applyDelta(const Frame& frame, Bytes& dst);
+    void applyDelta(const Frame& frame, gsl::span<const Byte> stored, Bytes& dst);
+    size_t inflate(const Frame& frame, gsl::span<const Byte> stored, Bytes& dst);
+    bool storeDelta(Frame& oldFrame, gsl::span<const Byte> oldState, gsl::span<const Byte> newState);
+    void store(Frame& frame, gsl::span<const uint8_t> bitmap, gsl::span<const Byte> delta);
+    bool relocateOldest();
+    gsl::span<const Byte> getStored(const Frame& frame) const;
+    static bool isBlockDirty(gsl::span<const Byte> bitmap, size_t block);
 
-    void compress(Bytes& oldFrame, const Bytes& newFrame);
-    void decompress(Bytes& oldFrame, const Bytes& newFrame);
+    std::shared_ptr<Frame> makeFrame(Bytes data, uint64_t frameNumber, uint64_t tag, bool keyframe);
+    std::optional<Snapshot> doPopFrame();
+    void thin();
+    void dropLostFrames();
+    int getStride(uint64_t age) const;
+    uint64_t getKeyframeSpacing(int stride) const;
+    void updateTierAges();
     void dropOldest();
+    void releaseFrame(std::shared_ptr<Frame> frame);
+    void returnBuffer(Bytes buffer);
 };
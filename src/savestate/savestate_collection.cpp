@@ -30,7 +30,7 @@ Future<std::optional<SaveState>> SaveStateCollection::saveGameState(SaveStateTyp
 	}
 
 	auto data = core->saveState(LibretroCore::SaveStateType::Normal);
-	auto screenshot = std::shared_ptr<Image>(core->getLastScreenImage());
+	auto screenshotFuture = core->getLastScreenImage();
 	const auto aspectRatio = core->getSystemAVInfo().aspectRatio;
 	const auto rotation = static_cast<uint8_t>(core->getSystemAVInfo().rotation);
 
@@ -52,7 +52,8 @@ Future<std::optional<SaveState>> SaveStateCollection::saveGameState(SaveStateTyp
 	uint64_t timestamp = getCurrentTimestamp();
 	uint32_t timePlayed = 0; // TODO
 
-	return Concurrent::execute(Executors::getCPU(), [=, data = std::move(data), screenshot = std::move(screenshot)] () -> std::optional<SaveState>
+	// Saving never waits on the screenshot, the file is written once it's ready
+	return screenshotFuture.then(Executors::getCPU(), [=, data = std::move(data)] (std::shared_ptr<Image> screenshot) -> std::optional<SaveState>
 	{
 		SaveState saveState;
 		saveState.setSaveData(data);
@@ -80,6 +80,7 @@ void InGameMenu::setupMenu()
 		options->addTextItem("resume", LocalisedString::fromHardcodedString("Resume"), -1, true);
 		options->addTextItem("reset", LocalisedString::fromHardcodedString("Reset"), -1, true);
 		options->addTextItem("savestates", LocalisedString::fromHardcodedString("Save/Load"), -1, true);
+		options->addTextItem("rewind", LocalisedString::fromHardcodedString("Rewind"), -1, true);
 		options->addTextItem("swapdisc", LocalisedString::fromHardcodedString("Swap Disc"), -1, true);
 		//options->add(std::make_shared<UIWidget>("", Vector2f(0, 100)));
 		options->addTextItem("input", LocalisedString::fromHardcodedString("Input"), -1, true);
@@ -122,6 +123,8 @@ void InGameMenu::onChooseOption(const String& optionId)
 		showSaveStates(false);
 	} else if (optionId == "savestates") {
 		showSaveStates(true);
+	} else if (optionId == "rewind") {
+		showRewind();
 	} else if (optionId == "swapdisc") {
 		showSwapDisc();
 	} else if (optionId == "input") {
@@ -140,6 +143,7 @@ void InGameMenu::showRoot()
 {
 	getWidget("optionsPane")->setActive(true);
 	getWidget("savestatePane")->setActive(false);
+	getWidget("rewindPane")->setActive(false);
 
 	getWidget("inputPanelContents")->clear();
 }
@@ -188,6 +192,33 @@ void InGameMenu::refreshSaveStateList(bool canSave)
 	}
 }
 
+void InGameMenu::showRewind()
+{
+	getWidget("optionsPane")->setActive(false);
+	getWidget("rewindPane")->setActive(true);
+
+	const auto rewindList = getWidgetAs<UIList>("rewindList");
+	rewindList->clear();
+
+	// Newest first, so the list scrubs back in time from where the game was paused
+	const float aspectRatio = gameCanvas.getCore().getSystemAVInfo().aspectRatio;
+	auto keyframes = gameCanvas.getRewindKeyframes();
+	for (auto iter = keyframes.rbegin(); iter != keyframes.rend(); ++iter) {
+		auto entry = std::make_shared<SaveStateCapsule>(factory, retrogradeEnvironment);
+		entry->loadData(iter->thumbnail.get(), aspectRatio, iter->age);
+		rewindList->addItem(toString(iter->frameNumber), std::move(entry), 1);
+	}
+
+	setHandle(UIEventType::ListAccept, "rewindList", [=] (const UIEvent& event)
+	{
+		if (gameCanvas.seekRewind(static_cast<uint64_t>(event.getStringData().toInteger()))) {
+			showRoot();
+			getWidgetAs<UIList>("options")->setSelectedOptionId("resume");
+			hide();
+		}
+	});
+}
+
 void InGameMenu::showSwapDisc()
 {
 	// TODO
@@ -266,14 +297,7 @@ SaveStateCapsule::SaveStateCapsule(UIFactory& factory, RetrogradeEnvironment& re
 void SaveStateCapsule::loadData(SaveStateCollection& ssc, SaveStateType type, size_t idx)
 {
 	if (const auto ss = ssc.getSaveState(type, idx)) {
-		auto image = ss->getScreenShot();
-
-		const float aspectRatio = ss->getScreenShotAspectRatio();
-		const auto maxSize = Vector2f(aspectRatio * 672.0f, 672.0f);
-
-		Sprite sprite = Sprite().setImage(retrogradeEnvironment.getResources(), *retrogradeEnvironment.getHalleyAPI().video, std::move(image), "Halley/SmoothPixel");
-		getWidgetAs<UIImage>("image")->setSprite(sprite);
-		getWidgetAs<UIImage>("image")->setMinSize(maxSize);
+		setImage(ss->getScreenShot(), ss->getScreenShotAspectRatio());
 
 		String label;
 		switch (type) {
@@ -294,6 +318,29 @@ void SaveStateCapsule::loadData(SaveStateCollection& ssc, SaveStateType type, si
 	}
 }
 
+void SaveStateCapsule::loadData(const Image* thumbnail, float aspectRatio, Time age)
+{
+	if (thumbnail) {
+		auto image = std::make_unique<Image>(Image::Format::RGBA, thumbnail->getSize(), false);
+		const auto src = thumbnail->getPixelBytes();
+		memcpy(image->getPixelBytes().data(), src.data(), src.size());
+		setImage(std::move(image), aspectRatio);
+	}
+
+	const auto seconds = static_cast<int>(std::lround(age));
+	const auto label = seconds < 60 ? toString(seconds) + "s ago" : toString(seconds / 60) + "m " + toString(seconds % 60) + "s ago";
+	getWidgetAs<UILabel>("label")->setText(LocalisedString::fromUserString(label));
+}
+
+void SaveStateCapsule::setImage(std::unique_ptr<Image> image, float aspectRatio)
+{
+	const auto maxSize = Vector2f(aspectRatio * 672.0f, 672.0f);
+
+	Sprite sprite = Sprite().setImage(retrogradeEnvironment.getResources(), *retrogradeEnvironment.getHalleyAPI().video, std::move(image), "Halley/SmoothPixel");
+	getWidgetAs<UIImage>("image")->setSprite(sprite);
+	getWidgetAs<UIImage>("image")->setMinSize(maxSize);
+}
+
 String SaveStateCapsule::getDate(uint64_t timestamp) const
 {
     std::time_t t = static_cast<std::time_t>(timestamp);
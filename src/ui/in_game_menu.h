@@ -34,6 +34,7 @@ private:
     void setupMenu();
     void showRoot();
     void showSaveStates(bool canSave);
+    void showRewind();
     void showSwapDisc();
     void showMedia();
     void showAchievements();
@@ -54,9 +55,11 @@ class SaveStateCapsule : public UIWidget {
 public:
     SaveStateCapsule(UIFactory& factory, RetrogradeEnvironment& retrogradeEnvironment);
     void loadData(SaveStateCollection& ssc, SaveStateType type, size_t idx);
+    void loadData(const Image* thumbnail, float aspectRatio, Time age);
 
 private:
     RetrogradeEnvironment& retrogradeEnvironment;
 
     String getDate(uint64_t timestamp) const;
+    void setImage(std::unique_ptr<Image> image, float aspectRatio);
 };
\ No newline at end of file
@@ -0,0 +1,66 @@
+#include "audio_convert.h"
+#include "cpu_features.h"
+
+#ifdef HAS_X86_SIMD
+#include <immintrin.h>
+#endif
+
+namespace {
+	constexpr float int16Scale = 1.0f / 32768.0f;
+
+	void int16ToFloatScalar(const int16_t* src, float* dst, size_t n)
+	{
+		for (size_t i = 0; i < n; ++i) {
+			dst[i] = src[i] * int16Scale;
+		}
+	}
+
+#ifdef HAS_X86_SIMD
+	size_t int16ToFloatSSE2(const int16_t* src, float* dst, size_t n)
+	{
+		const auto scale = _mm_set1_ps(int16Scale);
+		size_t i = 0;
+		for (; i + 8 <= n; i += 8) {
+			const auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+			// Interleave with itself and shift right, to sign extend to 32 bits
+			const auto lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+			const auto hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+			_mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+			_mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+		}
+		return i;
+	}
+
+	TARGET_AVX2 size_t int16ToFloatAVX2(const int16_t* src, float* dst, size_t n)
+	{
+		const auto scale = _mm256_set1_ps(int16Scale);
+		size_t i = 0;
+		for (; i + 16 <= n; i += 16) {
+			const auto lo = _mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i)));
+			const auto hi = _mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 8)));
+			_mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(lo), scale));
+			_mm256_storeu_ps(dst + i + 8, _mm256_mul_ps(_mm256_cvtepi32_ps(hi), scale));
+		}
+		return i;
+	}
+#endif
+}
+
+void AudioConvert::int16ToFloat(gsl::span<const int16_t> src, gsl::span<float> dst)
+{
+	assert(dst.size() >= src.size());
+
+	const size_t n = src.size();
+	size_t done = 0;
+
+#ifdef HAS_X86_SIMD
+	const auto& cpu = CPUFeatures::get();
+	if (cpu.hasAVX2()) {
+		done = int16ToFloatAVX2(src.data(), dst.data(), n);
+	} else if (cpu.hasSSE2()) {
+		done = int16ToFloatSSE2(src.data(), dst.data(), n);
+	}
+#endif
+
+	int16ToFloatScalar(src.data() + done, dst.data() + done, n - done);
+}
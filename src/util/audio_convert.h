@@ -0,0 +1,9 @@
+#pragma once
+
+#include <halley.hpp>
+using namespace Halley;
+
+namespace AudioConvert {
+	// Converts signed 16-bit samples to floats in the [-1, 1) range. dst must be at least as large as src.
+	void int16ToFloat(gsl::span<const int16_t> src, gsl::span<float> dst);
+}
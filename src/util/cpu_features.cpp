@@ -0,0 +1,74 @@
+#include "cpu_features.h"
+
+#ifdef HAS_X86_SIMD
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+namespace {
+#ifdef HAS_X86_SIMD
+	void cpuid(int leaf, int subLeaf, int regs[4])
+	{
+#ifdef _MSC_VER
+		__cpuidex(regs, leaf, subLeaf);
+#else
+		unsigned int a, b, c, d;
+		__cpuid_count(leaf, subLeaf, a, b, c, d);
+		regs[0] = static_cast<int>(a);
+		regs[1] = static_cast<int>(b);
+		regs[2] = static_cast<int>(c);
+		regs[3] = static_cast<int>(d);
+#endif
+	}
+
+	bool osSavesYMM()
+	{
+#ifdef _MSC_VER
+		const auto xcr0 = _xgetbv(0);
+#else
+		unsigned int eax, edx;
+		__asm__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+		const auto xcr0 = (static_cast<unsigned long long>(edx) << 32) | eax;
+#endif
+		return (xcr0 & 0x6) == 0x6;
+	}
+#endif
+}
+
+const CPUFeatures& CPUFeatures::get()
+{
+	static CPUFeatures features;
+	return features;
+}
+
+CPUFeatures::CPUFeatures()
+{
+#ifdef HAS_X86_SIMD
+	int regs[4];
+	cpuid(0, 0, regs);
+	const int maxLeaf = regs[0];
+
+	cpuid(1, 0, regs);
+	sse2 = (regs[3] & (1 << 26)) != 0;
+	const bool osxsave = (regs[2] & (1 << 27)) != 0;
+	const bool avx = (regs[2] & (1 << 28)) != 0;
+
+	if (maxLeaf >= 7 && osxsave && avx && osSavesYMM()) {
+		cpuid(7, 0, regs);
+		avx2 = (regs[1] & (1 << 5)) != 0;
+	}
+#endif
+}
+
+bool CPUFeatures::hasSSE2() const
+{
+	return sse2;
+}
+
+bool CPUFeatures::hasAVX2() const
+{
+	return avx2;
+}
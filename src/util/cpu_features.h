@@ -0,0 +1,26 @@
+#pragma once
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define HAS_X86_SIMD
+#endif
+
+// MSVC allows intrinsics for any instruction set, GCC and Clang need the function to be tagged
+#if defined(_MSC_VER) && !defined(__clang__)
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+class CPUFeatures {
+public:
+	static const CPUFeatures& get();
+
+	bool hasSSE2() const;
+	bool hasAVX2() const;
+
+private:
+	bool sse2 = false;
+	bool avx2 = false;
+
+	CPUFeatures();
+};
@@ -1,38 +1,203 @@
 #include "cpu_update_texture.h"
+#include "frame_diff.h"
 
-CPUUpdateTexture::CPUUpdateTexture(VideoAPI& videoAPI)
+String CPUUpdateTexture::Stats::toString() const
+{
+	auto mb = [] (uint64_t bytes) { return Halley::toString(static_cast<double>(bytes) / (1024.0 * 1024.0), 1) + " MB"; };
+	return Halley::toString(skippedFrames) + "/" + Halley::toString(frames) + " frames skipped, " + mb(bytesUploaded) + " of " + mb(bytesReceived) + " uploaded, "
+		+ mb(bytesCopied) + " copied";
+}
+
+CPUUpdateTexture::CPUUpdateTexture(VideoAPI& videoAPI, size_t ringSize)
 	: videoAPI(videoAPI)
 {
+	ring.resize(std::max(ringSize, static_cast<size_t>(1)));
 }
 
 std::shared_ptr<Texture> CPUUpdateTexture::getTexture() const
 {
-	return texture;
+	return ring[curSlot].texture;
 }
 
-void CPUUpdateTexture::updateSize(Vector2i size)
+void CPUUpdateTexture::updateSize(Vector2i size, TextureFormat format)
 {
-	if (!texture || texture->getSize() != size) {
-		texture = videoAPI.createTexture(size);
+	// Every slot is resized, so whichever one is shown or written next already matches
+	for (auto& slot: ring) {
+		if (!slot.texture || slot.texture->getSize() != size || slot.format != format) {
+			releaseTexture(std::move(slot.texture), slot.format);
+			slot.texture = acquireTexture(size, format);
+			slot.format = format;
+			slot.version = {};
+		}
 	}
 }
 
 void CPUUpdateTexture::update(Vector2i size, std::optional<int> stride, gsl::span<const gsl::byte> data, TextureFormat textureFormat)
 {
-	updateSize(size);
-	updateTexture(data, stride, textureFormat);
+	++frameCount;
+	++stats.frames;
+	stats.bytesReceived += data.size();
+
+	if (skipUnchangedFrame(size, stride, data, textureFormat)) {
+		++stats.skippedFrames;
+		return;
+	}
+
+	auto& slot = nextSlot();
+	if (!slot.texture || slot.texture->getSize() != size || slot.format != textureFormat || slot.stride != stride) {
+		// Resolution changes return the old texture to the pool, so switching back and forth doesn't reallocate
+		if (!slot.texture || slot.texture->getSize() != size || slot.format != textureFormat) {
+			releaseTexture(std::move(slot.texture), slot.format);
+			slot.texture = acquireTexture(size, textureFormat);
+			slot.format = textureFormat;
+		}
+		slot.stride = stride;
+		slot.version = {};
+	}
+
+	copyToStaging(slot, data, static_cast<size_t>(size.y));
+	slot.version = frameCount;
+	updateTexture(slot, data, stride, textureFormat);
+}
+
+bool CPUUpdateTexture::skipUnchangedFrame(Vector2i size, std::optional<int> stride, gsl::span<const gsl::byte> data, TextureFormat textureFormat)
+{
+	const auto& prev = ring[curSlot];
+	const auto height = static_cast<size_t>(size.y);
+	const bool sameLayout = prev.texture && prev.version && prev.texture->getSize() == size && prev.format == textureFormat && prev.stride == stride && prev.staging.size() >= data.size();
+
+	if (!sameLayout || !stride || height == 0) {
+		rowVersions.clear();
+		rowVersions.resize(height, frameCount);
+		return false;
+	}
+
+	if (dirtyRows.size() < height) {
+		dirtyRows.resize(height);
+	}
+
+	const auto pitch = static_cast<size_t>(*stride);
+	const auto nDirty = FrameDiff::findDirtyRows(data.data(), reinterpret_cast<const gsl::byte*>(prev.staging.data()), pitch, pitch, height, dirtyRows.span());
+	if (nDirty == 0) {
+		return true;
+	}
+
+	for (size_t y = 0; y < height; ++y) {
+		if (dirtyRows[y]) {
+			rowVersions[y] = frameCount;
+		}
+	}
+	return false;
+}
+
+void CPUUpdateTexture::copyToStaging(Slot& slot, gsl::span<const gsl::byte> data, size_t height)
+{
+	if (data.data() == reinterpret_cast<const gsl::byte*>(slot.staging.data())) {
+		// Already rendered in place
+		return;
+	}
+
+	if (slot.staging.size() < data.size()) {
+		slot.staging.resize(data.size());
+		slot.version = {};
+	}
+
+	if (slot.version && slot.stride && rowVersions.size() == height) {
+		// Only copy the rows that changed since this slot was last written
+		const auto pitch = static_cast<size_t>(*slot.stride);
+		for (size_t y = 0; y < height; ++y) {
+			if (rowVersions[y] > *slot.version) {
+				memcpy(slot.staging.data() + y * pitch, data.data() + y * pitch, pitch);
+				stats.bytesCopied += pitch;
+			}
+		}
+	} else {
+		memcpy(slot.staging.data(), data.data(), data.size());
+		stats.bytesCopied += data.size();
+	}
+}
+
+gsl::span<gsl::byte> CPUUpdateTexture::getNextStagingBuffer(size_t size)
+{
+	auto& slot = ring[(curSlot + 1) % ring.size()];
+	if (slot.staging.size() < size) {
+		slot.staging.resize(size);
+	}
+	return gsl::as_writable_bytes(gsl::span<Byte>(slot.staging.data(), size));
+}
+
+std::optional<CPUUpdateTexture::Frame> CPUUpdateTexture::getCurrentFrame() const
+{
+	const auto& slot = ring[curSlot];
+	if (!slot.texture || !slot.version || !slot.stride) {
+		return std::nullopt;
+	}
+
+	const auto size = slot.texture->getSize();
+	const auto bytes = static_cast<size_t>(*slot.stride) * static_cast<size_t>(size.y);
+	if (slot.staging.size() < bytes) {
+		return std::nullopt;
+	}
+	return Frame{ gsl::as_bytes(gsl::span<const Byte>(slot.staging.data(), bytes)), size, *slot.stride, slot.format };
+}
+
+const CPUUpdateTexture::Stats& CPUUpdateTexture::getStats() const
+{
+	return stats;
+}
+
+CPUUpdateTexture::Slot& CPUUpdateTexture::nextSlot()
+{
+	curSlot = (curSlot + 1) % ring.size();
+	return ring[curSlot];
+}
+
+std::shared_ptr<Texture> CPUUpdateTexture::acquireTexture(Vector2i size, TextureFormat format)
+{
+	const auto iter = std::find_if(pool.begin(), pool.end(), [&] (const PooledTexture& t)
+	{
+		return t.format == format && t.texture->getSize() == size;
+	});
+	if (iter != pool.end()) {
+		auto texture = std::move(iter->texture);
+		pool.erase(iter);
+		return texture;
+	}
+
+	return videoAPI.createTexture(size);
+}
+
+void CPUUpdateTexture::releaseTexture(std::shared_ptr<Texture> texture, TextureFormat format)
+{
+	if (!texture) {
+		return;
+	}
+
+	if (pool.size() >= maxPooledTextures) {
+		// Evict the least recently used
+		const auto iter = std::min_element(pool.begin(), pool.end(), [] (const PooledTexture& a, const PooledTexture& b)
+		{
+			return a.lastUsed < b.lastUsed;
+		});
+		pool.erase(iter);
+	}
+
+	pool.push_back(PooledTexture{ std::move(texture), format, frameCount });
 }
 
-void CPUUpdateTexture::updateTexture(gsl::span<const gsl::byte> data, std::optional<int> stride, TextureFormat textureFormat)
+void CPUUpdateTexture::updateTexture(Slot& slot, gsl::span<const gsl::byte> data, std::optional<int> stride, TextureFormat textureFormat)
 {
-	// TODO: implement texture updating API
-	texture->startLoading();
-	auto texDesc = TextureDescriptor(texture->getSize(), TextureFormat::RGBA);
+	// Halley has no API to map texture memory or update a sub-region, so the whole staging buffer of this slot is uploaded
+	stats.bytesUploaded += data.size();
+
+	auto& texture = *slot.texture;
+	texture.startLoading();
+	auto texDesc = TextureDescriptor(texture.getSize(), TextureFormat::RGBA);
 	texDesc.canBeUpdated = true;
 	texDesc.format = textureFormat;
 	texDesc.pixelFormat = PixelDataFormat::Image;
 	if (!data.empty()) {
-		texDesc.pixelData = TextureDescriptorImageData(data, stride);
+		texDesc.pixelData = TextureDescriptorImageData(gsl::as_bytes(gsl::span<const Byte>(slot.staging.data(), data.size())), stride);
 	}
-	texture->load(std::move(texDesc));
+	texture.load(std::move(texDesc));
 }
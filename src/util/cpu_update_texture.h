@@ -3,19 +3,78 @@
 #include <halley.hpp>
 using namespace Halley;
 
+// Streams CPU frames to the GPU through a small ring of textures, so the texture being written is never the one the
+// previous frame is still sampling from. Each slot keeps its own staging copy of the pixels, which stays valid until
+// the slot comes around again, so the upload can complete asynchronously.
 class CPUUpdateTexture {
 public:
-    CPUUpdateTexture(VideoAPI& videoAPI);
+    struct Stats {
+        uint64_t frames = 0;
+        uint64_t skippedFrames = 0;
+        uint64_t bytesReceived = 0;
+        uint64_t bytesUploaded = 0;
+        uint64_t bytesCopied = 0;
+
+        String toString() const;
+    };
+
+    struct Frame {
+        gsl::span<const gsl::byte> pixels;
+        Vector2i size;
+        int stride = 0;
+        TextureFormat format = TextureFormat::RGBA;
+    };
+
+    CPUUpdateTexture(VideoAPI& videoAPI, size_t ringSize = 3);
 
     std::shared_ptr<Texture> getTexture() const;
 
-    void updateSize(Vector2i size);
+    void updateSize(Vector2i size, TextureFormat format);
 	void update(Vector2i size, std::optional<int> stride, gsl::span<const gsl::byte> data, TextureFormat textureFormat);
+
+    // Staging memory for the next update(). If the frame is rendered straight into it, update() skips the copy.
+    gsl::span<gsl::byte> getNextStagingBuffer(size_t size);
+
+    // The pixels of the texture currently shown, straight from its staging copy. Only valid until the next update().
+    std::optional<Frame> getCurrentFrame() const;
+
+    const Stats& getStats() const;
     
 private:
+    struct Slot {
+        std::shared_ptr<Texture> texture;
+        Bytes staging;
+        TextureFormat format = TextureFormat::RGBA;
+        std::optional<int> stride;
+        std::optional<uint64_t> version; // Frame number of the contents of staging
+    };
+
+    struct PooledTexture {
+        std::shared_ptr<Texture> texture;
+        TextureFormat format;
+        uint64_t lastUsed = 0;
+    };
+
+    constexpr static size_t maxPooledTextures = 6;
+
     VideoAPI& videoAPI;
 
-    std::shared_ptr<Texture> texture;
+    Vector<Slot> ring;
+    size_t curSlot = 0;
+    Vector<PooledTexture> pool;
+    uint64_t frameCount = 0;
+
+    // Rows are compared against the previous frame, and each remembers the last frame it changed in.
+    // This way a slot only needs the rows that changed since it was last written.
+    Vector<uint64_t> rowVersions;
+    Vector<uint8_t> dirtyRows;
+    Stats stats;
+
+    bool skipUnchangedFrame(Vector2i size, std::optional<int> stride, gsl::span<const gsl::byte> data, TextureFormat textureFormat);
+    void copyToStaging(Slot& slot, gsl::span<const gsl::byte> data, size_t height);
 
-    void updateTexture(gsl::span<const gsl::byte> data, std::optional<int> stride, TextureFormat textureFormat);
+    Slot& nextSlot();
+    std::shared_ptr<Texture> acquireTexture(Vector2i size, TextureFormat format);
+    void releaseTexture(std::shared_ptr<Texture> texture, TextureFormat format);
+    void updateTexture(Slot& slot, gsl::span<const gsl::byte> data, std::optional<int> stride, TextureFormat textureFormat);
 };
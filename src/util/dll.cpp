@@ -69,6 +69,11 @@ bool DLL::isLoaded() const
 	return handle != nullptr;
 }
 
+const String& DLL::getFilename() const
+{
+	return filename;
+}
+
 void* DLL::getFunction(std::string_view name) const
 {
 	if (!handle) {
@@ -81,3 +86,14 @@ void* DLL::getFunction(std::string_view name) const
 	return dlsym(handle, name.data());
 #endif
 }
+
+std::string_view DLL::getExtension()
+{
+#if defined(_WIN32)
+	return ".dll";
+#elif defined(__APPLE__)
+	return ".dylib";
+#else
+	return ".so";
+#endif
+}
@@ -16,9 +16,12 @@ public:
     bool load(std::string_view filename);
     void unload();
     bool isLoaded() const;
+    const String& getFilename() const;
 
     void* getFunction(std::string_view name) const;
 
+    static std::string_view getExtension(); // Shared library extension for this platform, e.g. ".dll"
+
 private:
     void* handle = nullptr;
     String filename;
@@ -0,0 +1,128 @@
+#include "frame_diff.h"
+#include "cpu_features.h"
+
+#ifdef HAS_X86_SIMD
+#include <immintrin.h>
+#endif
+
+namespace {
+	using RowCompare = bool(*)(const gsl::byte* a, const gsl::byte* b, size_t bytes);
+	using XorFunction = void(*)(const gsl::byte* a, const gsl::byte* b, gsl::byte* dst, size_t bytes);
+
+	bool rowsEqualScalar(const gsl::byte* a, const gsl::byte* b, size_t bytes)
+	{
+		return memcmp(a, b, bytes) == 0;
+	}
+
+#ifdef HAS_X86_SIMD
+	bool rowsEqualSSE2(const gsl::byte* a, const gsl::byte* b, size_t bytes)
+	{
+		size_t i = 0;
+		for (; i + 64 <= bytes; i += 64) {
+			// Check a whole cache line at a time, so the early out doesn't cost a branch per vector
+			auto eq = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)), _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i)));
+			eq = _mm_and_si128(eq, _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i + 16)), _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i + 16))));
+			eq = _mm_and_si128(eq, _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i + 32)), _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i + 32))));
+			eq = _mm_and_si128(eq, _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i + 48)), _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i + 48))));
+			if (_mm_movemask_epi8(eq) != 0xFFFF) {
+				return false;
+			}
+		}
+		return rowsEqualScalar(a + i, b + i, bytes - i);
+	}
+
+	TARGET_AVX2 bool rowsEqualAVX2(const gsl::byte* a, const gsl::byte* b, size_t bytes)
+	{
+		size_t i = 0;
+		for (; i + 64 <= bytes; i += 64) {
+			auto eq = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i)), _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i)));
+			eq = _mm256_and_si256(eq, _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i + 32)), _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i + 32))));
+			if (_mm256_movemask_epi8(eq) != -1) {
+				return false;
+			}
+		}
+		return rowsEqualScalar(a + i, b + i, bytes - i);
+	}
+#endif
+
+	void xorBytesScalar(const gsl::byte* a, const gsl::byte* b, gsl::byte* dst, size_t bytes)
+	{
+		for (size_t i = 0; i < bytes; ++i) {
+			dst[i] = a[i] ^ b[i];
+		}
+	}
+
+#ifdef HAS_X86_SIMD
+	void xorBytesSSE2(const gsl::byte* a, const gsl::byte* b, gsl::byte* dst, size_t bytes)
+	{
+		size_t i = 0;
+		for (; i + 16 <= bytes; i += 16) {
+			const auto v = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)), _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i)));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), v);
+		}
+		xorBytesScalar(a + i, b + i, dst + i, bytes - i);
+	}
+
+	TARGET_AVX2 void xorBytesAVX2(const gsl::byte* a, const gsl::byte* b, gsl::byte* dst, size_t bytes)
+	{
+		size_t i = 0;
+		for (; i + 32 <= bytes; i += 32) {
+			const auto v = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i)), _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i)));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), v);
+		}
+		xorBytesScalar(a + i, b + i, dst + i, bytes - i);
+	}
+#endif
+
+	RowCompare getRowCompare()
+	{
+#ifdef HAS_X86_SIMD
+		const auto& cpu = CPUFeatures::get();
+		if (cpu.hasAVX2()) {
+			return rowsEqualAVX2;
+		} else if (cpu.hasSSE2()) {
+			return rowsEqualSSE2;
+		}
+#endif
+		return rowsEqualScalar;
+	}
+
+	XorFunction getXorFunction()
+	{
+#ifdef HAS_X86_SIMD
+		const auto& cpu = CPUFeatures::get();
+		if (cpu.hasAVX2()) {
+			return xorBytesAVX2;
+		} else if (cpu.hasSSE2()) {
+			return xorBytesSSE2;
+		}
+#endif
+		return xorBytesScalar;
+	}
+
+	const RowCompare rowCompare = getRowCompare();
+	const XorFunction xorFunction = getXorFunction();
+}
+
+bool FrameDiff::rowsEqual(const gsl::byte* a, const gsl::byte* b, size_t bytes)
+{
+	return rowCompare(a, b, bytes);
+}
+
+size_t FrameDiff::findDirtyRows(const gsl::byte* a, const gsl::byte* b, size_t pitch, size_t rowBytes, size_t height, gsl::span<uint8_t> dirty)
+{
+	assert(dirty.size() >= height);
+
+	size_t nDirty = 0;
+	for (size_t y = 0; y < height; ++y) {
+		const bool rowDirty = !rowCompare(a + y * pitch, b + y * pitch, rowBytes);
+		dirty[y] = rowDirty ? 1 : 0;
+		nDirty += rowDirty ? 1 : 0;
+	}
+	return nDirty;
+}
+
+void FrameDiff::xorBytes(const gsl::byte* a, const gsl::byte* b, gsl::byte* dst, size_t bytes)
+{
+	xorFunction(a, b, dst, bytes);
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <halley.hpp>
+using namespace Halley;
+
+namespace FrameDiff {
+	bool rowsEqual(const gsl::byte* a, const gsl::byte* b, size_t bytes);
+
+	// Compares two images row by row, setting dirty[y] for every row that differs. Returns the number of dirty rows.
+	size_t findDirtyRows(const gsl::byte* a, const gsl::byte* b, size_t pitch, size_t rowBytes, size_t height, gsl::span<uint8_t> dirty);
+
+	// dst = a ^ b. dst may alias a or b.
+	void xorBytes(const gsl::byte* a, const gsl::byte* b, gsl::byte* dst, size_t bytes);
+}
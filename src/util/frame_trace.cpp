@@ -0,0 +1,178 @@
+#include "frame_trace.h"
+
+class FrameTrace::ThreadBuffer {
+public:
+	constexpr static size_t capacity = 64 * 1024;
+
+	ThreadBuffer(int id)
+		: id(id)
+		, name("thread_" + toString(id))
+	{
+		events.resize(capacity);
+	}
+
+	void push(const Event& event)
+	{
+		// Only the owning thread writes, so a release store is all the reader needs
+		const auto idx = writeIdx.load(std::memory_order_relaxed);
+		events[idx % capacity] = event;
+		writeIdx.store(idx + 1, std::memory_order_release);
+	}
+
+	void collect(Vector<Event>& dst) const
+	{
+		const auto end = writeIdx.load(std::memory_order_acquire);
+		// Skip a margin at the old end, as the owning thread may be overwriting it while we read
+		constexpr size_t margin = 1024;
+		const auto start = end > capacity - margin ? end - (capacity - margin) : 0;
+		for (auto i = start; i < end; ++i) {
+			dst.push_back(events[i % capacity]);
+		}
+	}
+
+	const int id;
+	String name;
+
+private:
+	Vector<Event> events;
+	std::atomic<size_t> writeIdx = 0;
+};
+
+namespace {
+	std::atomic<uint64_t> curFrame = 0;
+
+	std::mutex& getRegistryMutex()
+	{
+		static std::mutex mutex;
+		return mutex;
+	}
+
+	// Buffers are kept alive after their thread exits, so their events can still be exported
+	Vector<std::shared_ptr<FrameTrace::ThreadBuffer>>& getRegistry()
+	{
+		static Vector<std::shared_ptr<FrameTrace::ThreadBuffer>> registry;
+		return registry;
+	}
+
+	std::set<String>& getInternedNames()
+	{
+		static std::set<String> names;
+		return names;
+	}
+
+	String escapeJSON(std::string_view str)
+	{
+		String result;
+		for (const char c: str) {
+			if (c == '"' || c == '\\') {
+				result += '\\';
+			}
+			if (static_cast<unsigned char>(c) >= 0x20) {
+				result += c;
+			}
+		}
+		return result;
+	}
+}
+
+const char* FrameTrace::intern(const String& name)
+{
+	std::unique_lock<std::mutex> lock(getRegistryMutex());
+	return getInternedNames().insert(name).first->c_str();
+}
+
+void FrameTrace::setThreadName(const String& name)
+{
+	auto& buffer = getThreadBuffer();
+	std::unique_lock<std::mutex> lock(getRegistryMutex());
+	buffer.name = name;
+}
+
+int64_t FrameTrace::now()
+{
+	static const auto epoch = std::chrono::steady_clock::now();
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+void FrameTrace::record(const char* name, int64_t start, int64_t end)
+{
+	getThreadBuffer().push(Event{ name, start, end - start });
+}
+
+void FrameTrace::beginFrame()
+{
+	getThreadBuffer().push(Event{ "frame_begin", now(), 0, ++curFrame, Event::Type::FrameBegin });
+}
+
+void FrameTrace::endFrame()
+{
+	getThreadBuffer().push(Event{ "frame_end", now(), 0, curFrame.load(), Event::Type::FrameEnd });
+}
+
+bool FrameTrace::exportChromeTrace(const Path& path)
+{
+	Vector<std::shared_ptr<ThreadBuffer>> buffers;
+	{
+		std::unique_lock<std::mutex> lock(getRegistryMutex());
+		buffers = getRegistry();
+	}
+
+	String json = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+	bool first = true;
+	auto addLine = [&] (const String& line)
+	{
+		if (!first) {
+			json += ",\n";
+		}
+		first = false;
+		json += line;
+	};
+
+	Vector<Event> events;
+	size_t nEvents = 0;
+	for (const auto& buffer: buffers) {
+		String threadName;
+		{
+			std::unique_lock<std::mutex> lock(getRegistryMutex());
+			threadName = buffer->name;
+		}
+		const auto tid = toString(buffer->id);
+		addLine("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" + tid + ",\"args\":{\"name\":\"" + escapeJSON(threadName) + "\"}}");
+
+		events.clear();
+		buffer->collect(events);
+		for (const auto& e: events) {
+			// Chrome traces use microseconds
+			const auto name = "{\"name\":\"" + escapeJSON(e.name ? e.name : "?") + "\"";
+			const auto ts = ",\"ts\":" + toString(static_cast<double>(e.start) / 1000.0, 3);
+			if (e.type == Event::Type::Scope) {
+				addLine(name + ",\"ph\":\"X\",\"pid\":1,\"tid\":" + tid + ts + ",\"dur\":" + toString(static_cast<double>(e.duration) / 1000.0, 3) + "}");
+			} else {
+				// Global scope instant events are drawn as a line across every thread
+				addLine(name + ",\"ph\":\"i\",\"s\":\"g\",\"pid\":1,\"tid\":" + tid + ts + ",\"args\":{\"frame\":" + toString(e.frame) + "}}");
+			}
+		}
+		nEvents += events.size();
+	}
+	json += "\n]}\n";
+
+	const bool ok = Path::writeFile(path, json);
+	if (ok) {
+		Logger::logInfo("Wrote " + toString(nEvents) + " trace events to " + path.getString());
+	} else {
+		Logger::logError("Failed to write trace to " + path.getString());
+	}
+	return ok;
+}
+
+FrameTrace::ThreadBuffer& FrameTrace::getThreadBuffer()
+{
+	thread_local std::shared_ptr<ThreadBuffer> buffer;
+	if (!buffer) {
+		std::unique_lock<std::mutex> lock(getRegistryMutex());
+		auto& registry = getRegistry();
+		buffer = std::make_shared<ThreadBuffer>(static_cast<int>(registry.size()) + 1);
+		registry.push_back(buffer);
+	}
+	return *buffer;
+}
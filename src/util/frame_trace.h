@@ -0,0 +1,62 @@
+#pragma once
+
+#include <halley.hpp>
+using namespace Halley;
+
+// Lightweight always-on timeline tracing
+// Each thread records completed scopes into its own ring buffer without locking, and the most recent events can be
+// exported at any time as a Chrome trace (load it in chrome://tracing or ui.perfetto.dev).
+class FrameTrace {
+public:
+	struct Event {
+		enum class Type : uint8_t {
+			Scope,
+			FrameBegin,
+			FrameEnd
+		};
+
+		const char* name = nullptr;
+		int64_t start = 0; // ns
+		int64_t duration = 0; // ns
+		uint64_t frame = 0; // Frame markers only
+		Type type = Type::Scope;
+	};
+
+	// Names must outlive the trace, use this for names that aren't string literals
+	static const char* intern(const String& name);
+
+	static void setThreadName(const String& name);
+	static int64_t now();
+	static void record(const char* name, int64_t start, int64_t end);
+
+	// Frame markers, exported as global instant events, so every thread's timeline can be read frame by frame
+	static void beginFrame();
+	static void endFrame();
+
+	static bool exportChromeTrace(const Path& path);
+
+	class ThreadBuffer;
+
+private:
+	static ThreadBuffer& getThreadBuffer();
+};
+
+class TraceScope {
+public:
+	explicit TraceScope(const char* name)
+		: name(name)
+		, start(FrameTrace::now())
+	{}
+
+	~TraceScope()
+	{
+		FrameTrace::record(name, start, FrameTrace::now());
+	}
+
+	TraceScope(const TraceScope& other) = delete;
+	TraceScope& operator=(const TraceScope& other) = delete;
+
+private:
+	const char* name;
+	int64_t start;
+};
@@ -93,7 +93,7 @@ std::shared_ptr<OpenGLInteropRenderTarget> OpenGLInterop::makeNativeRenderTarget
 std::shared_ptr<OpenGLInteropPixelCopy> OpenGLInterop::makeCopyPixelRenderTarget(Vector2i size)
 {
 	auto cpuUpdateTexture = std::make_shared<CPUUpdateTexture>(video);
-	cpuUpdateTexture->updateSize(size);
+	cpuUpdateTexture->updateSize(size, TextureFormat::RGBA);
 	return std::shared_ptr<OpenGLInteropPixelCopy>(new OpenGLInteropPixelCopy(std::move(cpuUpdateTexture)));
 }
 
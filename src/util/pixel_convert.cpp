@@ -0,0 +1,372 @@
+#include "pixel_convert.h"
+#include "cpu_features.h"
+
+#ifdef HAS_X86_SIMD
+#include <immintrin.h>
+#endif
+
+namespace {
+	using RowFunction = void(*)(const void* src, void* dst, size_t width);
+
+	constexpr uint32_t alphaMask = 0xFF000000;
+
+	// Expands a 5 or 6 bit channel to 8 bits by replicating the top bits into the bottom, so full intensity maps to 255
+	constexpr uint32_t expand5(uint32_t v) { return (v << 3) | (v >> 2); }
+	constexpr uint32_t expand6(uint32_t v) { return (v << 2) | (v >> 4); }
+
+	void rowXRGB1555Scalar(const void* src, void* dst, size_t width)
+	{
+		const auto* s = static_cast<const uint16_t*>(src);
+		auto* d = static_cast<uint32_t*>(dst);
+		for (size_t i = 0; i < width; ++i) {
+			const uint32_t p = s[i];
+			d[i] = expand5((p >> 10) & 0x1F) | (expand5((p >> 5) & 0x1F) << 8) | (expand5(p & 0x1F) << 16) | alphaMask;
+		}
+	}
+
+	void rowRGB565Scalar(const void* src, void* dst, size_t width)
+	{
+		const auto* s = static_cast<const uint16_t*>(src);
+		auto* d = static_cast<uint32_t*>(dst);
+		for (size_t i = 0; i < width; ++i) {
+			const uint32_t p = s[i];
+			d[i] = expand5((p >> 11) & 0x1F) | (expand6((p >> 5) & 0x3F) << 8) | (expand5(p & 0x1F) << 16) | alphaMask;
+		}
+	}
+
+	void rowXRGB8888Scalar(const void* src, void* dst, size_t width)
+	{
+		const auto* s = static_cast<const uint32_t*>(src);
+		auto* d = static_cast<uint32_t*>(dst);
+		for (size_t i = 0; i < width; ++i) {
+			const uint32_t p = s[i];
+			d[i] = ((p >> 16) & 0xFF) | (p & 0xFF00) | ((p & 0xFF) << 16) | alphaMask;
+		}
+	}
+
+	void rowXBGR8888Scalar(const void* src, void* dst, size_t width)
+	{
+		const auto* s = static_cast<const uint32_t*>(src);
+		auto* d = static_cast<uint32_t*>(dst);
+		for (size_t i = 0; i < width; ++i) {
+			d[i] = s[i] | alphaMask;
+		}
+	}
+
+#ifdef HAS_X86_SIMD
+	// SSE2 versions work on 32-bit lanes, so 16-bit pixels are widened first
+
+	inline __m128i expand5SSE2(__m128i v)
+	{
+		return _mm_or_si128(_mm_slli_epi32(v, 3), _mm_srli_epi32(v, 2));
+	}
+
+	inline __m128i expand6SSE2(__m128i v)
+	{
+		return _mm_or_si128(_mm_slli_epi32(v, 2), _mm_srli_epi32(v, 4));
+	}
+
+	inline __m128i convertXRGB1555SSE2(__m128i p)
+	{
+		const auto mask5 = _mm_set1_epi32(0x1F);
+		const auto r = expand5SSE2(_mm_and_si128(_mm_srli_epi32(p, 10), mask5));
+		const auto g = expand5SSE2(_mm_and_si128(_mm_srli_epi32(p, 5), mask5));
+		const auto b = expand5SSE2(_mm_and_si128(p, mask5));
+		return _mm_or_si128(_mm_or_si128(r, _mm_slli_epi32(g, 8)), _mm_or_si128(_mm_slli_epi32(b, 16), _mm_set1_epi32(static_cast<int>(alphaMask))));
+	}
+
+	inline __m128i convertRGB565SSE2(__m128i p)
+	{
+		const auto mask5 = _mm_set1_epi32(0x1F);
+		const auto r = expand5SSE2(_mm_and_si128(_mm_srli_epi32(p, 11), mask5));
+		const auto g = expand6SSE2(_mm_and_si128(_mm_srli_epi32(p, 5), _mm_set1_epi32(0x3F)));
+		const auto b = expand5SSE2(_mm_and_si128(p, mask5));
+		return _mm_or_si128(_mm_or_si128(r, _mm_slli_epi32(g, 8)), _mm_or_si128(_mm_slli_epi32(b, 16), _mm_set1_epi32(static_cast<int>(alphaMask))));
+	}
+
+	template <__m128i(*Convert)(__m128i), RowFunction Tail>
+	void row16SSE2(const void* src, void* dst, size_t width)
+	{
+		const auto* s = static_cast<const uint16_t*>(src);
+		auto* d = static_cast<uint32_t*>(dst);
+		const auto zero = _mm_setzero_si128();
+		size_t i = 0;
+		for (; i + 8 <= width; i += 8) {
+			const auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(d + i), Convert(_mm_unpacklo_epi16(v, zero)));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(d + i + 4), Convert(_mm_unpackhi_epi16(v, zero)));
+		}
+		Tail(s + i, d + i, width - i);
+	}
+
+	void rowXRGB8888SSE2(const void* src, void* dst, size_t width)
+	{
+		const auto* s = static_cast<const uint32_t*>(src);
+		auto* d = static_cast<uint32_t*>(dst);
+		const auto maskG = _mm_set1_epi32(0xFF00);
+		const auto maskR = _mm_set1_epi32(0xFF);
+		const auto maskB = _mm_set1_epi32(0xFF0000);
+		const auto alpha = _mm_set1_epi32(static_cast<int>(alphaMask));
+		size_t i = 0;
+		for (; i + 4 <= width; i += 4) {
+			const auto p = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+			const auto r = _mm_and_si128(_mm_srli_epi32(p, 16), maskR);
+			const auto g = _mm_and_si128(p, maskG);
+			const auto b = _mm_and_si128(_mm_slli_epi32(p, 16), maskB);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(d + i), _mm_or_si128(_mm_or_si128(r, g), _mm_or_si128(b, alpha)));
+		}
+		rowXRGB8888Scalar(s + i, d + i, width - i);
+	}
+
+	void rowXBGR8888SSE2(const void* src, void* dst, size_t width)
+	{
+		const auto* s = static_cast<const uint32_t*>(src);
+		auto* d = static_cast<uint32_t*>(dst);
+		const auto alpha = _mm_set1_epi32(static_cast<int>(alphaMask));
+		size_t i = 0;
+		for (; i + 4 <= width; i += 4) {
+			const auto p = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(d + i), _mm_or_si128(p, alpha));
+		}
+		rowXBGR8888Scalar(s + i, d + i, width - i);
+	}
+
+	TARGET_AVX2 inline __m256i expand5AVX2(__m256i v)
+	{
+		return _mm256_or_si256(_mm256_slli_epi32(v, 3), _mm256_srli_epi32(v, 2));
+	}
+
+	TARGET_AVX2 inline __m256i expand6AVX2(__m256i v)
+	{
+		return _mm256_or_si256(_mm256_slli_epi32(v, 2), _mm256_srli_epi32(v, 4));
+	}
+
+	TARGET_AVX2 void rowXRGB1555AVX2(const void* src, void* dst, size_t width)
+	{
+		const auto* s = static_cast<const uint16_t*>(src);
+		auto* d = static_cast<uint32_t*>(dst);
+		const auto mask5 = _mm256_set1_epi32(0x1F);
+		const auto alpha = _mm256_set1_epi32(static_cast<int>(alphaMask));
+		size_t i = 0;
+		for (; i + 8 <= width; i += 8) {
+			const auto p = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i)));
+			const auto r = expand5AVX2(_mm256_and_si256(_mm256_srli_epi32(p, 10), mask5));
+			const auto g = expand5AVX2(_mm256_and_si256(_mm256_srli_epi32(p, 5), mask5));
+			const auto b = expand5AVX2(_mm256_and_si256(p, mask5));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(d + i), _mm256_or_si256(_mm256_or_si256(r, _mm256_slli_epi32(g, 8)), _mm256_or_si256(_mm256_slli_epi32(b, 16), alpha)));
+		}
+		rowXRGB1555Scalar(s + i, d + i, width - i);
+	}
+
+	TARGET_AVX2 void rowRGB565AVX2(const void* src, void* dst, size_t width)
+	{
+		const auto* s = static_cast<const uint16_t*>(src);
+		auto* d = static_cast<uint32_t*>(dst);
+		const auto mask5 = _mm256_set1_epi32(0x1F);
+		const auto mask6 = _mm256_set1_epi32(0x3F);
+		const auto alpha = _mm256_set1_epi32(static_cast<int>(alphaMask));
+		size_t i = 0;
+		for (; i + 8 <= width; i += 8) {
+			const auto p = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i)));
+			const auto r = expand5AVX2(_mm256_and_si256(_mm256_srli_epi32(p, 11), mask5));
+			const auto g = expand6AVX2(_mm256_and_si256(_mm256_srli_epi32(p, 5), mask6));
+			const auto b = expand5AVX2(_mm256_and_si256(p, mask5));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(d + i), _mm256_or_si256(_mm256_or_si256(r, _mm256_slli_epi32(g, 8)), _mm256_or_si256(_mm256_slli_epi32(b, 16), alpha)));
+		}
+		rowRGB565Scalar(s + i, d + i, width - i);
+	}
+
+	TARGET_AVX2 void rowXRGB8888AVX2(const void* src, void* dst, size_t width)
+	{
+		const auto* s = static_cast<const uint32_t*>(src);
+		auto* d = static_cast<uint32_t*>(dst);
+		// Swap bytes 0 and 2 of every pixel, then force alpha
+		const auto shuffle = _mm256_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15, 2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+		const auto alpha = _mm256_set1_epi32(static_cast<int>(alphaMask));
+		size_t i = 0;
+		for (; i + 8 <= width; i += 8) {
+			const auto p = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(d + i), _mm256_or_si256(_mm256_shuffle_epi8(p, shuffle), alpha));
+		}
+		rowXRGB8888Scalar(s + i, d + i, width - i);
+	}
+
+	TARGET_AVX2 void rowXBGR8888AVX2(const void* src, void* dst, size_t width)
+	{
+		const auto* s = static_cast<const uint32_t*>(src);
+		auto* d = static_cast<uint32_t*>(dst);
+		const auto alpha = _mm256_set1_epi32(static_cast<int>(alphaMask));
+		size_t i = 0;
+		for (; i + 8 <= width; i += 8) {
+			const auto p = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(d + i), _mm256_or_si256(p, alpha));
+		}
+		rowXBGR8888Scalar(s + i, d + i, width - i);
+	}
+#endif
+
+	RowFunction getRowFunction(PixelConvert::Format format, PixelConvert::Kernel kernel)
+	{
+		using namespace PixelConvert;
+
+		switch (kernel) {
+#ifdef HAS_X86_SIMD
+		case Kernel::AVX2:
+			switch (format) {
+			case Format::XRGB1555:
+				return rowXRGB1555AVX2;
+			case Format::RGB565:
+				return rowRGB565AVX2;
+			case Format::XRGB8888:
+				return rowXRGB8888AVX2;
+			case Format::XBGR8888:
+				return rowXBGR8888AVX2;
+			}
+			break;
+		case Kernel::SSE2:
+			switch (format) {
+			case Format::XRGB1555:
+				return row16SSE2<convertXRGB1555SSE2, rowXRGB1555Scalar>;
+			case Format::RGB565:
+				return row16SSE2<convertRGB565SSE2, rowRGB565Scalar>;
+			case Format::XRGB8888:
+				return rowXRGB8888SSE2;
+			case Format::XBGR8888:
+				return rowXBGR8888SSE2;
+			}
+			break;
+#endif
+		default:
+			break;
+		}
+
+		switch (format) {
+		case Format::XRGB1555:
+			return rowXRGB1555Scalar;
+		case Format::RGB565:
+			return rowRGB565Scalar;
+		case Format::XBGR8888:
+			return rowXBGR8888Scalar;
+		case Format::XRGB8888:
+		default:
+			return rowXRGB8888Scalar;
+		}
+	}
+
+	size_t getBytesPerPixel(PixelConvert::Format format)
+	{
+		return format == PixelConvert::Format::XRGB8888 || format == PixelConvert::Format::XBGR8888 ? 4 : 2;
+	}
+}
+
+PixelConvert::Kernel PixelConvert::getBestKernel()
+{
+	const auto& cpu = CPUFeatures::get();
+	if (cpu.hasAVX2()) {
+		return Kernel::AVX2;
+	} else if (cpu.hasSSE2()) {
+		return Kernel::SSE2;
+	} else {
+		return Kernel::Scalar;
+	}
+}
+
+const char* PixelConvert::toString(Kernel kernel)
+{
+	switch (kernel) {
+	case Kernel::Scalar:
+		return "scalar";
+	case Kernel::SSE2:
+		return "SSE2";
+	case Kernel::AVX2:
+		return "AVX2";
+	}
+	return "unknown";
+}
+
+const char* PixelConvert::toString(Format format)
+{
+	switch (format) {
+	case Format::XRGB1555:
+		return "0RGB1555";
+	case Format::RGB565:
+		return "RGB565";
+	case Format::XRGB8888:
+		return "XRGB8888";
+	case Format::XBGR8888:
+		return "XBGR8888";
+	}
+	return "unknown";
+}
+
+void PixelConvert::toRGBA8(Format format, gsl::span<const gsl::byte> src, size_t srcPitch, gsl::span<gsl::byte> dst, size_t dstPitch, Vector2i size)
+{
+	static const Kernel bestKernel = getBestKernel();
+	toRGBA8(format, bestKernel, src, srcPitch, dst, dstPitch, size);
+}
+
+void PixelConvert::toRGBA8(Format format, Kernel kernel, gsl::span<const gsl::byte> src, size_t srcPitch, gsl::span<gsl::byte> dst, size_t dstPitch, Vector2i size)
+{
+	const auto width = static_cast<size_t>(size.x);
+	const auto height = static_cast<size_t>(size.y);
+	assert(srcPitch >= width * getBytesPerPixel(format));
+	assert(dstPitch >= width * 4);
+	assert(src.size() >= srcPitch * (height - 1) + width * getBytesPerPixel(format));
+	assert(dst.size() >= dstPitch * (height - 1) + width * 4);
+
+	const auto row = getRowFunction(format, kernel);
+	for (size_t y = 0; y < height; ++y) {
+		row(src.data() + y * srcPitch, dst.data() + y * dstPitch, width);
+	}
+}
+
+void PixelConvert::runBenchmark()
+{
+	using Clock = std::chrono::steady_clock;
+	const std::array<Vector2i, 4> sizes = { Vector2i(256, 224), Vector2i(640, 480), Vector2i(1280, 960), Vector2i(2560, 1920) };
+	const std::array<Format, 4> formats = { Format::XRGB1555, Format::RGB565, Format::XRGB8888, Format::XBGR8888 };
+
+	Vector<Kernel> kernels = { Kernel::Scalar };
+	const auto& cpu = CPUFeatures::get();
+	if (cpu.hasSSE2()) {
+		kernels.push_back(Kernel::SSE2);
+	}
+	if (cpu.hasAVX2()) {
+		kernels.push_back(Kernel::AVX2);
+	}
+
+	Logger::logInfo("Pixel conversion benchmark (throughput in GB/s, read + written):");
+	for (const auto format: formats) {
+		for (const auto size: sizes) {
+			const size_t srcPitch = size.x * getBytesPerPixel(format);
+			const size_t dstPitch = size.x * 4;
+			Bytes src(srcPitch * size.y);
+			Bytes dst(dstPitch * size.y);
+			for (size_t i = 0; i < src.size(); ++i) {
+				src[i] = static_cast<Byte>(i * 2654435761u >> 13);
+			}
+
+			String line = String(toString(format)) + " " + Halley::toString(size.x) + "x" + Halley::toString(size.y) + ":";
+			for (const auto kernel: kernels) {
+				// Warm up, then run for a fixed amount of time
+				toRGBA8(format, kernel, src.byte_span(), srcPitch, dst.byte_span(), dstPitch, size);
+
+				size_t iterations = 0;
+				const auto start = Clock::now();
+				auto now = start;
+				do {
+					for (int i = 0; i < 10; ++i) {
+						toRGBA8(format, kernel, src.byte_span(), srcPitch, dst.byte_span(), dstPitch, size);
+					}
+					iterations += 10;
+					now = Clock::now();
+				} while (now - start < std::chrono::milliseconds(250));
+
+				const auto seconds = std::chrono::duration<double>(now - start).count();
+				const auto gbPerSecond = static_cast<double>((src.size() + dst.size()) * iterations) / seconds / 1e9;
+				line += String(" ") + toString(kernel) + " " + Halley::toString(gbPerSecond, 2);
+			}
+			Logger::logInfo(line);
+		}
+	}
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <halley.hpp>
+using namespace Halley;
+
+// Converts libretro pixel formats to RGBA8, for video backends that don't support them natively
+namespace PixelConvert {
+	enum class Format {
+		XRGB1555,
+		RGB565,
+		XRGB8888,
+		XBGR8888 // Already RGBA in memory, only alpha is forced opaque, as in GPU readbacks
+	};
+
+	enum class Kernel {
+		Scalar,
+		SSE2,
+		AVX2
+	};
+
+	Kernel getBestKernel();
+	const char* toString(Kernel kernel);
+	const char* toString(Format format);
+
+	// The 32bpp formats (XRGB8888, XBGR8888) can be converted in place, with src and dst the same buffer and pitch.
+	// The 16bpp ones can't, as each output pixel is twice as wide as its input and would overwrite pixels not yet read.
+	void toRGBA8(Format format, gsl::span<const gsl::byte> src, size_t srcPitch, gsl::span<gsl::byte> dst, size_t dstPitch, Vector2i size);
+	void toRGBA8(Format format, Kernel kernel, gsl::span<const gsl::byte> src, size_t srcPitch, gsl::span<gsl::byte> dst, size_t dstPitch, Vector2i size);
+
+	// Logs throughput for each format, kernel and a few typical resolutions
+	void runBenchmark();
+}
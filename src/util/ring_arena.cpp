@@ -0,0 +1,150 @@
+#include "ring_arena.h"
+
+#ifdef _WIN32
+	#define WIN32_LEAN_AND_MEAN
+	#include <Windows.h>
+
+	#ifdef min
+		#undef min
+		#undef max
+	#endif
+#else
+	#include <sys/mman.h>
+#endif
+
+RingArena::RingArena(size_t capacity, bool hugePages)
+	: capacity(capacity)
+	, mappedSize(std::max(capacity, static_cast<size_t>(1)))
+{
+	// Mapped straight from the OS, so it's page aligned and never fragments the heap
+#ifdef _WIN32
+	if (hugePages) {
+		// Needs the "Lock pages in memory" privilege, so this often fails and falls back to regular pages
+		const size_t largePage = GetLargePageMinimum();
+		if (largePage > 0) {
+			const size_t size = (mappedSize + largePage - 1) / largePage * largePage;
+			data = static_cast<Byte*>(VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE));
+			if (data) {
+				mappedSize = size;
+			}
+		}
+	}
+	if (!data) {
+		data = static_cast<Byte*>(VirtualAlloc(nullptr, mappedSize, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE));
+	}
+#else
+	void* ptr = mmap(nullptr, mappedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	data = ptr == MAP_FAILED ? nullptr : static_cast<Byte*>(ptr);
+#ifdef MADV_HUGEPAGE
+	if (data && hugePages) {
+		// Transparent huge pages are only a hint, the kernel may still use regular pages
+		madvise(data, mappedSize, MADV_HUGEPAGE);
+	}
+#endif
+#endif
+
+	if (!data) {
+		throw Exception("Unable to allocate " + toString(capacity) + " bytes for ring arena", 0);
+	}
+}
+
+RingArena::~RingArena()
+{
+#ifdef _WIN32
+	VirtualFree(data, 0, MEM_RELEASE);
+#else
+	munmap(data, mappedSize);
+#endif
+}
+
+std::optional<RingArena::Handle> RingArena::allocate(size_t size)
+{
+	// Zero sized blocks would make a full ring look identical to an empty one
+	size = std::max(size, static_cast<size_t>(1));
+	if (size > capacity) {
+		return {};
+	}
+
+	size_t offset = 0;
+	if (!blocks.empty()) {
+		const size_t tail = blocks.front().offset;
+		const size_t head = blocks.back().offset + blocks.back().size;
+		if (!isWrapped()) {
+			if (capacity - head >= size) {
+				offset = head;
+			} else if (tail >= size) {
+				// Wrap around, the space left at the end is skipped until the tail wraps too
+				offset = 0;
+			} else {
+				return {};
+			}
+		} else {
+			if (tail - head >= size) {
+				offset = head;
+			} else {
+				return {};
+			}
+		}
+	}
+
+	blocks.push_back(Block{ offset, size, true });
+	return firstHandle + blocks.size() - 1;
+}
+
+void RingArena::free(Handle handle)
+{
+	getBlock(handle).live = false;
+	reclaim();
+}
+
+gsl::span<Byte> RingArena::get(Handle handle)
+{
+	const auto& block = getBlock(handle);
+	return gsl::span<Byte>(data + block.offset, block.size);
+}
+
+gsl::span<const Byte> RingArena::get(Handle handle) const
+{
+	const auto& block = getBlock(handle);
+	return gsl::span<const Byte>(data + block.offset, block.size);
+}
+
+size_t RingArena::getCapacity() const
+{
+	return capacity;
+}
+
+size_t RingArena::getUsed() const
+{
+	if (blocks.empty()) {
+		return 0;
+	}
+	const size_t tail = blocks.front().offset;
+	const size_t head = blocks.back().offset + blocks.back().size;
+	return isWrapped() ? capacity - tail + head : head - tail;
+}
+
+RingArena::Block& RingArena::getBlock(Handle handle)
+{
+	assert(handle >= firstHandle && handle - firstHandle < blocks.size());
+	return blocks[handle - firstHandle];
+}
+
+const RingArena::Block& RingArena::getBlock(Handle handle) const
+{
+	assert(handle >= firstHandle && handle - firstHandle < blocks.size());
+	return blocks[handle - firstHandle];
+}
+
+bool RingArena::isWrapped() const
+{
+	return !blocks.empty() && blocks.front().offset > blocks.back().offset;
+}
+
+void RingArena::reclaim()
+{
+	while (!blocks.empty() && !blocks.front().live) {
+		blocks.pop_front();
+		++firstHandle;
+	}
+}
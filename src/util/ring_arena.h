@@ -0,0 +1,46 @@
+#pragma once
+
+#include <halley.hpp>
+using namespace Halley;
+
+// A fixed size FIFO allocator over one contiguous block of memory
+// Allocations are carved at the head and space is only reclaimed from the tail, so freeing out of order leaves a hole until everything older is freed too
+class RingArena {
+public:
+    using Handle = uint64_t;
+
+    explicit RingArena(size_t capacity, bool hugePages = false);
+    ~RingArena();
+
+    RingArena(const RingArena& other) = delete;
+    RingArena& operator=(const RingArena& other) = delete;
+
+    std::optional<Handle> allocate(size_t size);
+    void free(Handle handle);
+
+    gsl::span<Byte> get(Handle handle);
+    gsl::span<const Byte> get(Handle handle) const;
+
+    // Used counts everything from the oldest live allocation to the newest, holes included
+    size_t getCapacity() const;
+    size_t getUsed() const;
+
+private:
+    struct Block {
+        size_t offset;
+        size_t size;
+        bool live;
+    };
+
+    Byte* data = nullptr;
+    size_t capacity = 0;
+    size_t mappedSize = 0;
+
+    std::deque<Block> blocks;
+    Handle firstHandle = 0;
+
+    Block& getBlock(Handle handle);
+    const Block& getBlock(Handle handle) const;
+    bool isWrapped() const;
+    void reclaim();
+};
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <halley.hpp>
+using namespace Halley;
+
+// Lock-free, fixed capacity, single producer single consumer queue
+template <typename T>
+class SPSCQueue {
+public:
+    explicit SPSCQueue(size_t capacity)
+    {
+        buffer.resize(nextPowerOf2(std::max(capacity, static_cast<size_t>(2))));
+        mask = buffer.size() - 1;
+    }
+
+    bool tryPush(const T& value)
+    {
+        const auto h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) >= buffer.size()) {
+            return false;
+        }
+        buffer[h & mask] = value;
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool tryPop(T& value)
+    {
+        const auto t = tail.load(std::memory_order_relaxed);
+        if (t == head.load(std::memory_order_acquire)) {
+            return false;
+        }
+        value = buffer[t & mask];
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Pushes as many values as fit, returning how many were pushed
+    size_t push(gsl::span<const T> values)
+    {
+        const auto h = head.load(std::memory_order_relaxed);
+        const auto n = std::min(values.size(), buffer.size() - (h - tail.load(std::memory_order_acquire)));
+        const auto start = h & mask;
+        const auto first = std::min(n, buffer.size() - start);
+        std::copy_n(values.begin(), first, buffer.begin() + start);
+        std::copy_n(values.begin() + first, n - first, buffer.begin());
+        head.store(h + n, std::memory_order_release);
+        return n;
+    }
+
+    // Pops up to dst.size() values, returning how many were popped
+    size_t pop(gsl::span<T> dst)
+    {
+        const auto t = tail.load(std::memory_order_relaxed);
+        const auto n = std::min(dst.size(), head.load(std::memory_order_acquire) - t);
+        const auto start = t & mask;
+        const auto first = std::min(n, buffer.size() - start);
+        std::copy_n(buffer.begin() + start, first, dst.begin());
+        std::copy_n(buffer.begin(), n - first, dst.begin() + first);
+        tail.store(t + n, std::memory_order_release);
+        return n;
+    }
+
+    size_t size() const
+    {
+        return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+    }
+
+    size_t capacity() const
+    {
+        return buffer.size();
+    }
+
+private:
+    Vector<T> buffer;
+    size_t mask = 0;
+    alignas(64) std::atomic<size_t> head = 0;
+    alignas(64) std::atomic<size_t> tail = 0;
+};
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <halley.hpp>
+using namespace Halley;
+
+// Lock-free single producer, single consumer triple buffer
+// The writer always has a buffer to write to, and the reader always gets the most recently published one
+template <typename T>
+class TripleBuffer {
+public:
+    T& getWriteBuffer()
+    {
+        return buffers[writeIdx];
+    }
+
+    void publish()
+    {
+        writeIdx = shared.exchange(static_cast<uint8_t>(writeIdx | dirtyBit), std::memory_order_acq_rel) & indexMask;
+    }
+
+    bool consume()
+    {
+        if ((shared.load(std::memory_order_relaxed) & dirtyBit) == 0) {
+            return false;
+        }
+        readIdx = shared.exchange(readIdx, std::memory_order_acq_rel) & indexMask;
+        return true;
+    }
+
+    const T& getReadBuffer() const
+    {
+        return buffers[readIdx];
+    }
+
+    T& getReadBuffer()
+    {
+        return buffers[readIdx];
+    }
+
+private:
+    constexpr static uint8_t indexMask = 0x3;
+    constexpr static uint8_t dirtyBit = 0x4;
+
+    std::array<T, 3> buffers;
+    uint8_t writeIdx = 0;
+    uint8_t readIdx = 1;
+    std::atomic<uint8_t> shared = 2;
+};
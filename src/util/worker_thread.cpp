@@ -0,0 +1,68 @@
+#include "worker_thread.h"
+
+#include "frame_trace.h"
+
+WorkerThread::WorkerThread(String name, MakeThread makeThread)
+{
+	if (makeThread) {
+		thread = makeThread(name, [=] () { FrameTrace::setThreadName(name); run(); });
+	} else {
+		thread = std::thread([=] () { FrameTrace::setThreadName(name); run(); });
+	}
+}
+
+WorkerThread::~WorkerThread()
+{
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		running = false;
+	}
+	jobAvailable.notify_all();
+	if (thread.joinable()) {
+		thread.join();
+	}
+}
+
+void WorkerThread::post(std::function<void()> job)
+{
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		jobs.push_back(std::move(job));
+	}
+	jobAvailable.notify_one();
+}
+
+void WorkerThread::wait(size_t maxPendingJobs)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	jobDone.wait(lock, [&] () { return jobs.size() + (busy ? 1 : 0) <= maxPendingJobs; });
+}
+
+size_t WorkerThread::getPendingJobs() const
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	return jobs.size() + (busy ? 1 : 0);
+}
+
+void WorkerThread::run()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	while (true) {
+		jobAvailable.wait(lock, [&] () { return !jobs.empty() || !running; });
+		if (jobs.empty()) {
+			// Only exit once every posted job has run
+			break;
+		}
+
+		auto job = std::move(jobs.front());
+		jobs.pop_front();
+		busy = true;
+
+		lock.unlock();
+		job();
+		lock.lock();
+
+		busy = false;
+		jobDone.notify_all();
+	}
+}
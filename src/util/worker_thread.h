@@ -0,0 +1,32 @@
+#pragma once
+
+#include <halley.hpp>
+#include <condition_variable>
+using namespace Halley;
+
+// Runs jobs in submission order on a single dedicated thread
+class WorkerThread {
+public:
+    using MakeThread = std::function<std::thread(String, std::function<void()>)>;
+
+    WorkerThread(String name, MakeThread makeThread = {});
+    ~WorkerThread();
+
+    WorkerThread(const WorkerThread& other) = delete;
+    WorkerThread& operator=(const WorkerThread& other) = delete;
+
+    void post(std::function<void()> job);
+    void wait(size_t maxPendingJobs = 0);
+    size_t getPendingJobs() const;
+
+private:
+    std::thread thread;
+    mutable std::mutex mutex;
+    std::condition_variable jobAvailable;
+    std::condition_variable jobDone;
+    std::deque<std::function<void()>> jobs;
+    bool busy = false;
+    bool running = true;
+
+    void run();
+};
@@ -0,0 +1,532 @@
+/* vim: set et sw=3 ts=3 sts=3: */
+/*
+ * Frontend stress core.
+ *
+ * Does no emulation at all, so any time spent running it is frontend overhead.
+ * Every knob is a core option, so each frontend path (upload, audio, rewind, input
+ * and environment callbacks) can be loaded independently.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <math.h>
+
+#ifndef M_PI
+#define M_PI 3.1415926535897932384626433832795f
+#endif
+
+#include "libretro.h"
+
+#define STRESS_FPS 60.0
+
+static struct retro_log_callback logging;
+static retro_log_printf_t log_cb;
+
+static retro_video_refresh_t video_cb;
+static retro_audio_sample_t audio_cb;
+static retro_audio_sample_batch_t audio_batch_cb;
+static retro_environment_t environ_cb;
+static retro_input_poll_t input_poll_cb;
+static retro_input_state_t input_state_cb;
+
+/* Settings */
+static unsigned width = 320;
+static unsigned height = 240;
+static enum retro_pixel_format pixel_format = RETRO_PIXEL_FORMAT_XRGB8888;
+static size_t state_size = 64 * 1024;
+static unsigned state_change_pct = 1;
+static unsigned video_change_pct = 100;
+static unsigned sample_rate = 48000;
+static unsigned audio_batch = 0; /* 0 = whole frame in one batch */
+static bool audio_single = false;
+static unsigned input_polls = 1;
+static unsigned env_calls = 0;
+static bool use_frontend_fb = false;
+
+/* State */
+static uint8_t *frame_buf;
+static size_t frame_pitch;
+static uint8_t *state_buf;
+static int16_t *audio_buf;
+static size_t audio_buf_frames;
+static uint32_t rng = 0x12345678;
+static unsigned frame_count;
+static unsigned video_row;
+static double audio_phase;
+static double audio_frac;
+static uint32_t input_accum;
+static bool av_info_dirty;
+
+static void fallback_log(enum retro_log_level level, const char *fmt, ...)
+{
+   (void)level;
+   va_list va;
+   va_start(va, fmt);
+   vfprintf(stderr, fmt, va);
+   va_end(va);
+}
+
+static uint32_t xorshift(void)
+{
+   rng ^= rng << 13;
+   rng ^= rng >> 17;
+   rng ^= rng << 5;
+   return rng;
+}
+
+static unsigned bytes_per_pixel(void)
+{
+   return pixel_format == RETRO_PIXEL_FORMAT_XRGB8888 ? 4 : 2;
+}
+
+static const char *get_var(const char *key)
+{
+   struct retro_variable var = { .key = key };
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+      return var.value;
+   return NULL;
+}
+
+static unsigned get_var_uint(const char *key, unsigned fallback)
+{
+   const char *value = get_var(key);
+   return value ? (unsigned)strtoul(value, NULL, 10) : fallback;
+}
+
+static size_t parse_size(const char *value, size_t fallback)
+{
+   if (!value)
+      return fallback;
+
+   char *end = NULL;
+   size_t result = strtoul(value, &end, 10);
+   if (end && (*end == 'K' || *end == 'k'))
+      result *= 1024;
+   else if (end && (*end == 'M' || *end == 'm'))
+      result *= 1024 * 1024;
+   return result;
+}
+
+static void alloc_buffers(void)
+{
+   free(frame_buf);
+   free(state_buf);
+   free(audio_buf);
+
+   frame_pitch = width * bytes_per_pixel();
+   frame_buf = calloc(height, frame_pitch);
+
+   state_buf = malloc(state_size ? state_size : 1);
+   for (size_t i = 0; i < state_size; i++)
+      state_buf[i] = (uint8_t)xorshift();
+
+   audio_buf_frames = sample_rate / 10 + 1;
+   audio_buf = calloc(audio_buf_frames * 2, sizeof(int16_t));
+}
+
+static void check_variables(bool initial)
+{
+   unsigned old_width = width;
+   unsigned old_height = height;
+   unsigned old_rate = sample_rate;
+   size_t old_state_size = state_size;
+
+   const char *value = get_var("stress_resolution");
+   if (value)
+      sscanf(value, "%ux%u", &width, &height);
+
+   if (initial)
+   {
+      /* The pixel format can only be set while loading */
+      value = get_var("stress_pixel_format");
+      if (value && !strcmp(value, "RGB565"))
+         pixel_format = RETRO_PIXEL_FORMAT_RGB565;
+      else if (value && !strcmp(value, "0RGB1555"))
+         pixel_format = RETRO_PIXEL_FORMAT_0RGB1555;
+      else
+         pixel_format = RETRO_PIXEL_FORMAT_XRGB8888;
+   }
+
+   state_size = parse_size(get_var("stress_serialize_size"), state_size);
+   state_change_pct = get_var_uint("stress_state_change", state_change_pct);
+   video_change_pct = get_var_uint("stress_video_change", video_change_pct);
+   sample_rate = get_var_uint("stress_samplerate", sample_rate);
+
+   value = get_var("stress_audio_batch");
+   if (value)
+   {
+      audio_single = !strcmp(value, "single");
+      audio_batch = (audio_single || !strcmp(value, "frame")) ? 0 : (unsigned)strtoul(value, NULL, 10);
+   }
+
+   input_polls = get_var_uint("stress_input_polls", input_polls);
+   env_calls = get_var_uint("stress_env_calls", env_calls);
+
+   value = get_var("stress_frontend_fb");
+   if (value)
+      use_frontend_fb = !strcmp(value, "true");
+
+   if (initial || old_width != width || old_height != height || old_rate != sample_rate || old_state_size != state_size)
+   {
+      alloc_buffers();
+      av_info_dirty = !initial && (old_width != width || old_height != height || old_rate != sample_rate);
+   }
+
+   log_cb(RETRO_LOG_INFO, "Stress: %ux%u fmt %d, state %u bytes (%u%%/frame), video %u%%/frame, audio %u Hz batch %u%s, %u polls, %u env calls.\n",
+         width, height, (int)pixel_format, (unsigned)state_size, state_change_pct, video_change_pct,
+         sample_rate, audio_batch, audio_single ? " (single)" : "", input_polls, env_calls);
+}
+
+void retro_init(void)
+{
+}
+
+void retro_deinit(void)
+{
+   free(frame_buf);
+   free(state_buf);
+   free(audio_buf);
+   frame_buf = NULL;
+   state_buf = NULL;
+   audio_buf = NULL;
+}
+
+unsigned retro_api_version(void)
+{
+   return RETRO_API_VERSION;
+}
+
+void retro_set_controller_port_device(unsigned port, unsigned device)
+{
+   (void)port;
+   (void)device;
+}
+
+void retro_get_system_info(struct retro_system_info *info)
+{
+   memset(info, 0, sizeof(*info));
+   info->library_name     = "StressCore";
+   info->library_version  = "v1";
+   info->need_fullpath    = true;
+   info->valid_extensions = NULL; // Content is ignored.
+}
+
+void retro_get_system_av_info(struct retro_system_av_info *info)
+{
+   info->timing = (struct retro_system_timing) {
+      .fps = STRESS_FPS,
+      .sample_rate = sample_rate,
+   };
+
+   info->geometry = (struct retro_game_geometry) {
+      .base_width   = width,
+      .base_height  = height,
+      .max_width    = width,
+      .max_height   = height,
+      .aspect_ratio = (float)width / (float)height,
+   };
+}
+
+void retro_set_environment(retro_environment_t cb)
+{
+   environ_cb = cb;
+
+   static const struct retro_variable vars[] = {
+      { "stress_resolution", "Resolution; 320x240|256x224|640x480|1280x720|1920x1080|2560x1440|3840x2160" },
+      { "stress_pixel_format", "Pixel format; XRGB8888|RGB565|0RGB1555" },
+      { "stress_serialize_size", "Serialize size; 64K|256|16K|256K|1M|4M|16M|64M" },
+      { "stress_state_change", "State bytes changed per frame (%); 1|0|5|10|25|50|100" },
+      { "stress_video_change", "Video rows changed per frame (%); 100|0|1|10|25|50" },
+      { "stress_samplerate", "Sample rate; 48000|32040|44100|96000" },
+      { "stress_audio_batch", "Audio batch size; frame|single|1|16|64|256|1024" },
+      { "stress_input_polls", "Input polls per frame; 1|0|2|4|16|64" },
+      { "stress_env_calls", "Environment calls per frame; 0|10|100|1000|10000" },
+      { "stress_frontend_fb", "Render into frontend framebuffer; false|true" },
+      { NULL, NULL },
+   };
+
+   cb(RETRO_ENVIRONMENT_SET_VARIABLES, (void*)vars);
+
+   bool no_content = true;
+   cb(RETRO_ENVIRONMENT_SET_SUPPORT_NO_GAME, &no_content);
+
+   if (cb(RETRO_ENVIRONMENT_GET_LOG_INTERFACE, &logging))
+      log_cb = logging.log;
+   else
+      log_cb = fallback_log;
+}
+
+void retro_set_audio_sample(retro_audio_sample_t cb)
+{
+   audio_cb = cb;
+}
+
+void retro_set_audio_sample_batch(retro_audio_sample_batch_t cb)
+{
+   audio_batch_cb = cb;
+}
+
+void retro_set_input_poll(retro_input_poll_t cb)
+{
+   input_poll_cb = cb;
+}
+
+void retro_set_input_state(retro_input_state_t cb)
+{
+   input_state_cb = cb;
+}
+
+void retro_set_video_refresh(retro_video_refresh_t cb)
+{
+   video_cb = cb;
+}
+
+void retro_reset(void)
+{
+   frame_count = 0;
+   video_row = 0;
+   audio_phase = 0;
+}
+
+static void run_input(void)
+{
+   for (unsigned i = 0; i < input_polls; i++)
+   {
+      input_poll_cb();
+      for (unsigned port = 0; port < 2; port++)
+      {
+         for (unsigned id = 0; id <= RETRO_DEVICE_ID_JOYPAD_R3; id++)
+            input_accum += input_state_cb(port, RETRO_DEVICE_JOYPAD, 0, id);
+         input_accum += input_state_cb(port, RETRO_DEVICE_ANALOG, RETRO_DEVICE_INDEX_ANALOG_LEFT, RETRO_DEVICE_ID_ANALOG_X);
+         input_accum += input_state_cb(port, RETRO_DEVICE_ANALOG, RETRO_DEVICE_INDEX_ANALOG_LEFT, RETRO_DEVICE_ID_ANALOG_Y);
+      }
+   }
+}
+
+static void run_env_calls(void)
+{
+   for (unsigned i = 0; i < env_calls; i++)
+   {
+      switch (i % 3)
+      {
+         case 0:
+         {
+            bool updated = false;
+            environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE_UPDATE, &updated);
+            break;
+         }
+         case 1:
+         {
+            int enable = 0;
+            environ_cb(RETRO_ENVIRONMENT_GET_AUDIO_VIDEO_ENABLE, &enable);
+            break;
+         }
+         default:
+            get_var("stress_resolution");
+            break;
+      }
+   }
+}
+
+static void run_state(void)
+{
+   /* Touch random 64 byte runs, which is roughly how RAM changes in a real system */
+   const size_t run = 64;
+   size_t to_change = state_size * state_change_pct / 100;
+   while (to_change > 0 && state_size >= run)
+   {
+      size_t offset = (xorshift() % (state_size / run)) * run;
+      size_t n = to_change < run ? to_change : run;
+      for (size_t i = 0; i < n; i++)
+         state_buf[offset + i] += (uint8_t)(frame_count + i);
+      to_change -= n;
+   }
+}
+
+static void run_video(void)
+{
+   /* Changed rows are a band sweeping down the screen, so the rest of the frame stays identical */
+   unsigned rows = height * video_change_pct / 100;
+   for (unsigned i = 0; i < rows; i++)
+   {
+      unsigned y = video_row;
+      video_row = (video_row + 1) % height;
+
+      uint8_t *line = frame_buf + y * frame_pitch;
+      if (bytes_per_pixel() == 4)
+      {
+         uint32_t *pixels = (uint32_t*)line;
+         for (unsigned x = 0; x < width; x++)
+            pixels[x] = ((x + frame_count) & 0xff) << 16 | ((y + frame_count) & 0xff) << 8 | (frame_count & 0xff);
+      }
+      else
+      {
+         uint16_t *pixels = (uint16_t*)line;
+         for (unsigned x = 0; x < width; x++)
+            pixels[x] = (uint16_t)((x + frame_count) ^ (y << 5));
+      }
+   }
+
+   if (rows == 0 && frame_count > 0)
+   {
+      video_cb(NULL, width, height, frame_pitch);
+      return;
+   }
+
+   if (use_frontend_fb)
+   {
+      struct retro_framebuffer fb = {0};
+      fb.width = width;
+      fb.height = height;
+      fb.access_flags = RETRO_MEMORY_ACCESS_WRITE;
+      if (environ_cb(RETRO_ENVIRONMENT_GET_CURRENT_SOFTWARE_FRAMEBUFFER, &fb) && fb.format == pixel_format && fb.data)
+      {
+         /* Frontend memory can't be trusted to hold last frame's contents, so copy all of it */
+         uint8_t *dst = fb.data;
+         for (unsigned y = 0; y < height; y++)
+            memcpy(dst + y * fb.pitch, frame_buf + y * frame_pitch, frame_pitch);
+         video_cb(fb.data, width, height, fb.pitch);
+         return;
+      }
+   }
+
+   video_cb(frame_buf, width, height, frame_pitch);
+}
+
+static void run_audio(void)
+{
+   audio_frac += sample_rate / STRESS_FPS;
+   size_t frames = (size_t)audio_frac;
+   audio_frac -= frames;
+   if (frames > audio_buf_frames)
+      frames = audio_buf_frames;
+
+   const double step = 2.0 * M_PI * 440.0 / sample_rate;
+   for (size_t i = 0; i < frames; i++)
+   {
+      int16_t val = (int16_t)(0x800 * sin(audio_phase));
+      audio_buf[i * 2] = val;
+      audio_buf[i * 2 + 1] = val;
+      audio_phase += step;
+   }
+   audio_phase = fmod(audio_phase, 2.0 * M_PI);
+
+   if (audio_single)
+   {
+      for (size_t i = 0; i < frames; i++)
+         audio_cb(audio_buf[i * 2], audio_buf[i * 2 + 1]);
+      return;
+   }
+
+   size_t batch = audio_batch ? audio_batch : frames;
+   for (size_t i = 0; i < frames; i += batch)
+   {
+      size_t n = frames - i < batch ? frames - i : batch;
+      audio_batch_cb(audio_buf + i * 2, n);
+   }
+}
+
+void retro_run(void)
+{
+   bool updated = false;
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE_UPDATE, &updated) && updated)
+      check_variables(false);
+
+   if (av_info_dirty)
+   {
+      struct retro_system_av_info info;
+      retro_get_system_av_info(&info);
+      environ_cb(RETRO_ENVIRONMENT_SET_SYSTEM_AV_INFO, &info);
+      av_info_dirty = false;
+   }
+
+   run_input();
+   run_env_calls();
+   run_state();
+   run_video();
+   run_audio();
+
+   frame_count++;
+}
+
+bool retro_load_game(const struct retro_game_info *info)
+{
+   (void)info;
+
+   check_variables(true);
+
+   enum retro_pixel_format fmt = pixel_format;
+   if (!environ_cb(RETRO_ENVIRONMENT_SET_PIXEL_FORMAT, &fmt))
+   {
+      log_cb(RETRO_LOG_ERROR, "Pixel format %d is not supported.\n", (int)fmt);
+      return false;
+   }
+
+   return true;
+}
+
+void retro_unload_game(void)
+{
+}
+
+unsigned retro_get_region(void)
+{
+   return RETRO_REGION_NTSC;
+}
+
+bool retro_load_game_special(unsigned type, const struct retro_game_info *info, size_t num)
+{
+   (void)type;
+   (void)info;
+   (void)num;
+   return false;
+}
+
+size_t retro_serialize_size(void)
+{
+   return state_size + sizeof(frame_count);
+}
+
+bool retro_serialize(void *data_, size_t size)
+{
+   if (size < retro_serialize_size())
+      return false;
+
+   uint8_t *data = data_;
+   memcpy(data, &frame_count, sizeof(frame_count));
+   memcpy(data + sizeof(frame_count), state_buf, state_size);
+   return true;
+}
+
+bool retro_unserialize(const void *data_, size_t size)
+{
+   if (size < retro_serialize_size())
+      return false;
+
+   const uint8_t *data = data_;
+   memcpy(&frame_count, data, sizeof(frame_count));
+   memcpy(state_buf, data + sizeof(frame_count), state_size);
+   return true;
+}
+
+void *retro_get_memory_data(unsigned id)
+{
+   return id == RETRO_MEMORY_SYSTEM_RAM ? state_buf : NULL;
+}
+
+size_t retro_get_memory_size(unsigned id)
+{
+   return id == RETRO_MEMORY_SYSTEM_RAM ? state_size : 0;
+}
+
+void retro_cheat_reset(void)
+{}
+
+void retro_cheat_set(unsigned index, bool enabled, const char *code)
+{
+   (void)index;
+   (void)enabled;
+   (void)code;
+}